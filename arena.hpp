@@ -0,0 +1,147 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Counts what an Arena handed out, and how often it had to go to the heap.
+struct ArenaUsage {
+	size_t allocations = 0;
+	size_t heap_allocations = 0;
+	// Largest amount in use between two resets.
+	size_t peak_bytes = 0;
+	size_t capacity = 0;
+
+	void operator+= (const ArenaUsage &other) {
+		allocations += other.allocations;
+		heap_allocations += other.heap_allocations;
+		peak_bytes = std::max(peak_bytes, other.peak_bytes);
+		capacity += other.capacity;
+	}
+};
+
+// Bump allocator for scratch memory that lives at most until the next
+// reset(), e.g. while a single tile is processed. Deallocation does nothing.
+// Chunks are kept across resets, and a reset after a tile that needed more
+// than one chunk merges them, so once the arena has seen the largest tile no
+// heap allocations are left. Used through std::pmr containers, by one thread
+// at a time.
+class Arena : public std::pmr::memory_resource {
+public:
+	explicit Arena(size_t chunk_size = size_t(64) << 10)
+	: _chunk_size(chunk_size)
+	{}
+
+	// Copies start out empty, they never share chunks.
+	Arena(const Arena &other)
+	: Arena(other._chunk_size)
+	{}
+
+	Arena(Arena &&) = default;
+
+	Arena &operator= (const Arena &) = delete;
+	Arena &operator= (Arena &&) = default;
+
+	// Releases what was allocated during its lifetime when it ends, so a
+	// loop can reuse the same, cached, memory in every step.
+	class Scope {
+	public:
+		explicit Scope(Arena &arena)
+		: _arena(arena), _current(arena._current), _used(arena._used),
+		_in_use(arena._in_use)
+		{}
+
+		Scope(const Scope &) = delete;
+		Scope operator= (const Scope &) = delete;
+
+		~Scope() {
+			_arena._current = _current;
+			_arena._used = _used;
+			_arena._in_use = _in_use;
+		}
+	private:
+		Arena &_arena;
+		size_t _current, _used, _in_use;
+	};
+
+	// Releases everything allocated since the last reset.
+	void reset() {
+		if (_chunks.size() > 1) {
+			_chunks.clear();
+			_add_chunk(_usage.capacity);
+		}
+		_current = 0;
+		_used = 0;
+		_in_use = 0;
+	}
+
+	const ArenaUsage &get_usage() const {
+		return _usage;
+	}
+private:
+	struct Chunk {
+		std::unique_ptr<std::byte[]> data;
+		size_t size;
+	};
+
+	void *do_allocate(size_t bytes, size_t alignment) override {
+		_usage.allocations++;
+		while (true) {
+			if (_current < _chunks.size()) {
+				auto &chunk = _chunks[_current];
+				const auto base = reinterpret_cast<uintptr_t>(
+						chunk.data.get());
+				const auto offset = (base + _used + alignment - 1) /
+					alignment * alignment - base;
+				if (offset + bytes <= chunk.size) {
+					_in_use += offset + bytes - _used;
+					_usage.peak_bytes = std::max(_usage.peak_bytes,
+							_in_use);
+					_used = offset + bytes;
+					return chunk.data.get() + offset;
+				}
+				if (_current + 1 < _chunks.size()) {
+					_current++;
+					_used = 0;
+					continue;
+				}
+			}
+
+			// Doubles the capacity, so a growing tile needs few chunks.
+			_add_chunk(std::max({_chunk_size, bytes + alignment,
+						_usage.capacity}));
+			_current = _chunks.size() - 1;
+			_used = 0;
+		}
+	}
+
+	void do_deallocate(void *, size_t, size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const
+		noexcept override {
+		return this == &other;
+	}
+
+	void _add_chunk(size_t size) {
+		_chunks.push_back(Chunk{std::make_unique_for_overwrite<std::byte[]>(
+					size), size});
+		_usage.heap_allocations++;
+		_usage.capacity = 0;
+		for (auto &chunk : _chunks)
+			_usage.capacity += chunk.size;
+	}
+
+	size_t _chunk_size;
+	std::vector<Chunk> _chunks;
+	size_t _current = 0;
+	// Bytes used in the current chunk, and in all chunks since the reset.
+	size_t _used = 0;
+	size_t _in_use = 0;
+	ArenaUsage _usage;
+};
+
+#endif // ARENA_HPP
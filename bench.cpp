@@ -0,0 +1,441 @@
+#include <benchmark/benchmark.h>
+#include <omp.h>
+#include <stdio.h>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "experiment.hpp"
+#include "frontier.hpp"
+#include "graph.hpp"
+#include "util.hpp"
+
+namespace {
+	// Every benchmark graph is a NUM_BLOCKS x NUM_BLOCKS grid of tiles.
+	constexpr size_t NUM_BLOCKS = 8;
+	constexpr uint64_t SEED = 42;
+
+	// Tile density is given in edges per thousand crossbar cells.
+	const std::vector<int64_t> DENSITIES = {1, 10, 100};
+	const std::vector<int64_t> CROSSBAR_SIZES = {64, 128, 256};
+	const std::vector<int64_t> THREADS = {1, 2, 4};
+
+	CrossbarOptions graphr_options(size_t crossbar_size) {
+		CrossbarOptions options;
+		options.num_rows = crossbar_size;
+		options.num_cols = crossbar_size;
+		options.cols_per_adc = 4;
+		options.datatype_size = 8;
+		options.input_size = 8;
+		options.read_device = ADC;
+		options.read_latency = 10e-9;
+		options.read_energy = 40e-15;
+		options.write_latency = 100e-9;
+		options.write_energy = 20e-12;
+		options.adc_latency = 1e-9;
+		options.adc_energy = 2e-12;
+		options.sa_latency = 1e-9;
+		options.sa_energy = 10e-15;
+		options.static_energy = 11.8e-12;
+		options.static_latency = 0.5e-9;
+		options.dynamic_energy = 0;
+		options.dynamic_latency = 0;
+		return options;
+	}
+
+	CrossbarOptions sparse_mem_options(size_t crossbar_size) {
+		CrossbarOptions options = graphr_options(crossbar_size);
+		options.cols_per_adc = 0.25;
+		options.datatype_size = 9;
+		options.input_size = 0;
+		options.read_device = SA;
+		options.static_energy = 0;
+		options.static_latency = 0;
+		options.dynamic_energy = 28.8e-12;
+		options.dynamic_latency = 1.1e-9;
+		return options;
+	}
+
+	template <typename Approach>
+	constexpr bool is_graphr = false;
+	template <bool PageRank>
+	constexpr bool is_graphr<Graphr<PageRank>> = true;
+
+	template <typename Approach>
+	CrossbarOptions approach_options(size_t crossbar_size) {
+		if constexpr (is_graphr<Approach>)
+			return graphr_options(crossbar_size);
+		else
+			return sparse_mem_options(crossbar_size);
+	}
+
+	size_t num_edges(size_t crossbar_size, size_t density) {
+		const auto dimensions = NUM_BLOCKS * crossbar_size;
+		return dimensions * dimensions * density / 1000;
+	}
+
+	// Writes a uniformly random edge list once per configuration. The seed
+	// is fixed, so every commit benchmarks the same graphs.
+	std::string edge_file(size_t crossbar_size, size_t density) {
+		static std::map<std::pair<size_t, size_t>, std::string> files;
+		auto &path = files[{crossbar_size, density}];
+		if (!path.empty())
+			return path;
+
+		path = std::filesystem::temp_directory_path() / ("bench_graph_" +
+				std::to_string(crossbar_size) + "_" +
+				std::to_string(density) + ".txt");
+
+		const auto dimensions = NUM_BLOCKS * crossbar_size;
+		std::mt19937_64 rng(SEED);
+		std::uniform_int_distribution<size_t> vertex(0, dimensions - 1);
+
+		FILE *fp = fopen(path.c_str(), "w");
+		for (size_t k = 0; k < num_edges(crossbar_size, density); k++)
+			fprintf(fp, "%zu %zu\n", vertex(rng), vertex(rng));
+		// Pins the dimensions to the full grid.
+		fprintf(fp, "%zu %zu\n", dimensions - 1, dimensions - 1);
+		fclose(fp);
+		return path;
+	}
+
+	std::shared_ptr<Graph> load_graph(size_t crossbar_size, size_t density) {
+		static std::map<std::pair<size_t, size_t>,
+			std::shared_ptr<Graph>> graphs;
+		auto &graph = graphs[{crossbar_size, density}];
+		if (!graph)
+			graph = std::make_shared<Graph>(
+					edge_file(crossbar_size, density),
+					crossbar_size, crossbar_size);
+		return graph;
+	}
+
+	std::shared_ptr<Graph> load_compressed_graph(size_t crossbar_size,
+			size_t density) {
+		static std::map<std::pair<size_t, size_t>,
+			std::shared_ptr<Graph>> graphs;
+		auto &graph = graphs[{crossbar_size, density}];
+		if (!graph) {
+			graph = std::make_shared<Graph>(
+					edge_file(crossbar_size, density),
+					crossbar_size, crossbar_size);
+			graph->compress_tiles();
+		}
+		return graph;
+	}
+
+	size_t tile_index(size_t crossbar_size, size_t row, size_t col) {
+		return col * crossbar_size + row;
+	}
+
+	SubGraph load_tile(size_t crossbar_size, size_t density) {
+		return load_graph(crossbar_size, density)->get_subgraph_at(
+				tile_index(crossbar_size, 1, 1));
+	}
+
+	// PageRank style state, every row is active.
+	struct KernelData {
+		explicit KernelData(size_t dimensions)
+		: score(dimensions, 1.0 / dimensions), new_score(dimensions, 0)
+		{}
+
+		std::vector<double> score;
+		std::vector<double> new_score;
+	};
+
+	auto row_func = [] (KernelData &data, size_t real_row)
+		-> std::optional<float> {
+			return data.score[real_row];
+		};
+
+	auto multi_row_func = [] (KernelData &data) -> std::optional<double> {
+		return data.score[0];
+	};
+
+	template <typename Approach>
+	auto element_func() {
+		if constexpr (is_graphr<Approach>)
+			return [] (KernelData &data, auto &elem, size_t j) {
+				data.new_score[j] += elem.weight;
+			};
+		else
+			return [] (KernelData &data, size_t j, float input) {
+				data.new_score[j] += input;
+			};
+	}
+
+	auto merge_func = [] (KernelData &data,
+			const std::vector<KernelData> &local_datas) {
+		for (auto &local_data : local_datas)
+			vector_binop(data.new_score, local_data.new_score,
+					std::plus<void>());
+		return true;
+	};
+}
+
+static void BM_GraphConstruction(benchmark::State &state) {
+	const auto crossbar_size = state.range(0);
+	const auto density = state.range(1);
+	const auto path = edge_file(crossbar_size, density);
+
+	for (auto _ : state) {
+		Graph graph(path, crossbar_size, crossbar_size);
+		benchmark::DoNotOptimize(graph.get_dimensions());
+	}
+	state.SetItemsProcessed(state.iterations() *
+			num_edges(crossbar_size, density));
+}
+BENCHMARK(BM_GraphConstruction)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES})
+	->Unit(benchmark::kMillisecond);
+
+template <bool Compressed>
+static void BM_GetSubgraphAt(benchmark::State &state) {
+	const auto crossbar_size = state.range(0);
+	const auto graph = Compressed ?
+		load_compressed_graph(crossbar_size, state.range(1)) :
+		load_graph(crossbar_size, state.range(1));
+
+	SubGraph subgraph;
+	for (auto _ : state) {
+		for (size_t col = 0; col < NUM_BLOCKS; col++) {
+			for (size_t row = 0; row < NUM_BLOCKS; row++) {
+				graph->get_subgraph_at(
+						tile_index(crossbar_size, row, col), subgraph);
+				benchmark::DoNotOptimize(subgraph.rows.data());
+			}
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * NUM_BLOCKS * NUM_BLOCKS);
+}
+BENCHMARK_TEMPLATE(BM_GetSubgraphAt, false)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+BENCHMARK_TEMPLATE(BM_GetSubgraphAt, true)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+
+// Includes the clear that precedes every write in Experiment.
+template <typename Approach>
+static void BM_ExpandToCrossbar(benchmark::State &state) {
+	const auto crossbar_size = state.range(0);
+	const auto tile = load_tile(crossbar_size, state.range(1));
+	Approach approach(approach_options<Approach>(crossbar_size));
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(approach.clear());
+		benchmark::DoNotOptimize(approach.expand_to_crossbar(tile));
+	}
+	state.SetItemsProcessed(state.iterations() * tile.size());
+}
+BENCHMARK_TEMPLATE(BM_ExpandToCrossbar, Graphr<true>)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+BENCHMARK_TEMPLATE(BM_ExpandToCrossbar, SparseMEM<true>)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+
+template <typename Approach, bool MultiRow>
+static void BM_RunKernel(benchmark::State &state) {
+	const auto crossbar_size = state.range(0);
+	const auto tile = load_tile(crossbar_size, state.range(1));
+	Approach approach(approach_options<Approach>(crossbar_size));
+	approach.expand_to_crossbar(tile);
+	KernelData data(NUM_BLOCKS * crossbar_size);
+
+	for (auto _ : state) {
+		if constexpr (MultiRow)
+			benchmark::DoNotOptimize(approach.run_kernel(multi_row_func,
+						element_func<Approach>(), data));
+		else
+			benchmark::DoNotOptimize(approach.run_kernel(row_func,
+						element_func<Approach>(), data));
+	}
+	state.SetItemsProcessed(state.iterations() * crossbar_size);
+}
+BENCHMARK_TEMPLATE2(BM_RunKernel, Graphr<true>, false)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+BENCHMARK_TEMPLATE2(BM_RunKernel, Graphr<true>, true)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+BENCHMARK_TEMPLATE2(BM_RunKernel, SparseMEM<true>, false)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+BENCHMARK_TEMPLATE2(BM_RunKernel, SparseMEM<true>, true)
+	->ArgNames({"crossbar", "density"})
+	->ArgsProduct({CROSSBAR_SIZES, DENSITIES});
+
+// One full iteration over the tile grid, as run by the PageRank driver.
+template <typename Approach>
+static void BM_ExperimentRunKernel(benchmark::State &state) {
+	const auto crossbar_size = 128;
+	const auto graph = load_graph(crossbar_size, state.range(1));
+
+	const auto max_threads = omp_get_max_threads();
+	omp_set_num_threads(state.range(0));
+	{
+		Experiment<Approach, KernelData> experiment(
+				approach_options<Approach>(crossbar_size),
+				graph->get_dimensions());
+		experiment.set_graph(graph);
+
+		for (auto _ : state)
+			experiment.run_kernel(row_func, element_func<Approach>(),
+					[] (SubGraph &, KernelData &) {});
+	}
+	omp_set_num_threads(max_threads);
+	state.SetItemsProcessed(state.iterations() * NUM_BLOCKS * NUM_BLOCKS);
+}
+BENCHMARK_TEMPLATE(BM_ExperimentRunKernel, Graphr<true>)
+	->ArgNames({"threads", "density"})
+	->ArgsProduct({THREADS, DENSITIES})
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ExperimentRunKernel, SparseMEM<true>)
+	->ArgNames({"threads", "density"})
+	->ArgsProduct({THREADS, DENSITIES})
+	->UseRealTime()
+	->Unit(benchmark::kMillisecond);
+
+static void BM_CrossbarReadRow(benchmark::State &state) {
+	const auto crossbar_size = state.range(0);
+	auto options = graphr_options(crossbar_size);
+	options.packed = state.range(1);
+	Crossbar<Graphr<true>::Data> crossbar(options);
+
+	for (auto _ : state)
+		for (size_t i = 0; i < crossbar.get_num_rows(); i++)
+			benchmark::DoNotOptimize(crossbar.readRow(i, 0,
+						crossbar.get_num_cols()));
+	state.SetItemsProcessed(state.iterations() * crossbar_size);
+}
+BENCHMARK(BM_CrossbarReadRow)
+	->ArgNames({"crossbar", "packed"})
+	->ArgsProduct({CROSSBAR_SIZES, {0, 1}});
+
+static void BM_CrossbarReadWithInput(benchmark::State &state) {
+	const auto crossbar_size = state.range(0);
+	Crossbar<Graphr<true>::Data> crossbar(graphr_options(crossbar_size));
+
+	for (auto _ : state)
+		for (size_t i = 0; i < crossbar.get_num_rows(); i++)
+			benchmark::DoNotOptimize(crossbar.readWithInput(i, 0,
+						crossbar.get_num_cols(), 1));
+	state.SetItemsProcessed(state.iterations() * crossbar_size);
+}
+BENCHMARK(BM_CrossbarReadWithInput)
+	->ArgName("crossbar")
+	->ArgsProduct({CROSSBAR_SIZES});
+
+static void BM_CrossbarMultiReadWithInput(benchmark::State &state) {
+	const auto crossbar_size = state.range(0);
+	auto options = graphr_options(crossbar_size);
+	options.packed = state.range(1);
+	Crossbar<Graphr<true>::Data> crossbar(options);
+
+	for (auto _ : state)
+		benchmark::DoNotOptimize(crossbar.multiReadWithInput(0,
+					crossbar.get_num_rows(), 0,
+					crossbar.get_num_cols(), 1));
+	state.SetItemsProcessed(state.iterations() * crossbar_size);
+}
+BENCHMARK(BM_CrossbarMultiReadWithInput)
+	->ArgNames({"crossbar", "packed"})
+	->ArgsProduct({CROSSBAR_SIZES, {0, 1}});
+
+// Merge of the per-thread copies after an iteration.
+static void BM_AggregateData(benchmark::State &state) {
+	const auto crossbar_size = state.range(1);
+	const auto graph = load_graph(crossbar_size, DENSITIES[0]);
+
+	const auto max_threads = omp_get_max_threads();
+	omp_set_num_threads(state.range(0));
+	{
+		Experiment<Graphr<true>, KernelData> experiment(
+				graphr_options(crossbar_size), graph->get_dimensions());
+		experiment.set_graph(graph);
+		experiment.run_kernel(row_func, element_func<Graphr<true>>(),
+				[] (SubGraph &, KernelData &) {});
+
+		for (auto _ : state)
+			benchmark::DoNotOptimize(experiment.aggregate_data(merge_func));
+	}
+	omp_set_num_threads(max_threads);
+	state.SetItemsProcessed(state.iterations() * state.range(0) *
+			graph->get_dimensions());
+}
+BENCHMARK(BM_AggregateData)
+	->ArgNames({"threads", "crossbar"})
+	->ArgsProduct({THREADS, CROSSBAR_SIZES});
+
+// Frontier merge and reset after a BFS/SSSP iteration, with density in
+// members per thousand vertices.
+static void BM_FrontierMerge(benchmark::State &state) {
+	const size_t num_vertices = 1 << 20;
+	std::mt19937_64 rng(SEED);
+	Frontier local(num_vertices, 128), global(num_vertices, 128);
+	const auto members = num_vertices * state.range(0) / 1000;
+	for (size_t k = 0; k < members; k++)
+		local.insert(rng() % num_vertices);
+
+	for (auto _ : state) {
+		global.merge(local);
+		benchmark::DoNotOptimize(global.count());
+		global.clear();
+	}
+	state.SetItemsProcessed(state.iterations() * num_vertices);
+}
+BENCHMARK(BM_FrontierMerge)
+	->ArgName("density")
+	->ArgsProduct({DENSITIES});
+
+// Same with the std::vector<bool> frontier the drivers used before.
+static void BM_VectorBoolMerge(benchmark::State &state) {
+	const size_t num_vertices = 1 << 20;
+	std::mt19937_64 rng(SEED);
+	std::vector<bool> local(num_vertices), global(num_vertices);
+	const auto members = num_vertices * state.range(0) / 1000;
+	for (size_t k = 0; k < members; k++)
+		local[rng() % num_vertices] = true;
+
+	for (auto _ : state) {
+		vector_binop(global, local, std::bit_or<void>());
+		benchmark::DoNotOptimize(global);
+		std::fill(global.begin(), global.end(), false);
+	}
+	state.SetItemsProcessed(state.iterations() * num_vertices);
+}
+BENCHMARK(BM_VectorBoolMerge)
+	->ArgName("density")
+	->ArgsProduct({DENSITIES});
+
+// Reports JSON unless another format is asked for, so runs of different
+// commits can be diffed with google benchmark's compare.py.
+int main(int argc, char **argv) {
+	static char json_format[] = "--benchmark_format=json";
+
+	std::vector<char *> args(argv, argv + argc);
+	bool has_format = false;
+	for (auto arg : args)
+		if (std::string(arg).starts_with("--benchmark_format"))
+			has_format = true;
+	if (!has_format)
+		args.insert(args.begin() + 1, json_format);
+
+	int num_args = args.size();
+	args.push_back(nullptr);
+	benchmark::Initialize(&num_args, args.data());
+	if (benchmark::ReportUnrecognizedArguments(num_args, args.data()))
+		return 1;
+
+	benchmark::AddCustomContext("omp_max_threads",
+			std::to_string(omp_get_max_threads()));
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -4,8 +4,16 @@
 #include "stats.hpp"
 
 #include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cmath>
+#include <concepts>
 #include <vector>
+#include <memory_resource>
+#include <span>
 #include <tuple>
 #include <iostream>
 
@@ -32,126 +40,340 @@ struct CrossbarOptions {
 	float static_latency;
 	float dynamic_energy;
 	float dynamic_latency;
+	// Store cells as datatype_size bit codes, see PackedCell.
+	bool packed = false;
 };
 
+// Operations on a crossbar, as the number of calls of each kind and the cells
+// they covered. The Stats of the operations follow from these and the
+// CrossbarOptions alone, see counted_stats.
+struct CrossbarCounters {
+	uint64_t writes = 0, written_cells = 0;
+	uint64_t reads = 0, read_cells = 0;
+	uint64_t input_reads = 0, input_read_cells = 0;
+	uint64_t multi_reads = 0, multi_read_cols = 0, multi_read_cells = 0;
+	// Read cells the periphery handled one by one, see dynamic_stats.
+	uint64_t dynamic_cells = 0;
+	// Results of space_efficiency.
+	double efficiency = 0;
+	uint64_t num_efficiencies = 0;
+
+	void operator+= (const CrossbarCounters &other) {
+		writes += other.writes;
+		written_cells += other.written_cells;
+		reads += other.reads;
+		read_cells += other.read_cells;
+		input_reads += other.input_reads;
+		input_read_cells += other.input_read_cells;
+		multi_reads += other.multi_reads;
+		multi_read_cols += other.multi_read_cols;
+		multi_read_cells += other.multi_read_cells;
+		dynamic_cells += other.dynamic_cells;
+		efficiency += other.efficiency;
+		num_efficiencies += other.num_efficiencies;
+	}
+
+	void operator-= (const CrossbarCounters &other) {
+		writes -= other.writes;
+		written_cells -= other.written_cells;
+		reads -= other.reads;
+		read_cells -= other.read_cells;
+		input_reads -= other.input_reads;
+		input_read_cells -= other.input_read_cells;
+		multi_reads -= other.multi_reads;
+		multi_read_cols -= other.multi_read_cols;
+		multi_read_cells -= other.multi_read_cells;
+		dynamic_cells -= other.dynamic_cells;
+		efficiency -= other.efficiency;
+		num_efficiencies -= other.num_efficiencies;
+	}
+};
+
+inline float analogue_latency(const CrossbarOptions &options) {
+	switch (options.read_device) {
+		case ADC:
+			return options.adc_latency;
+		case SA:
+			return options.sa_latency;
+		default:
+			assert(!"What");
+	}
+}
+
+inline float analogue_energy(const CrossbarOptions &options) {
+	switch (options.read_device) {
+		case ADC:
+			return options.adc_energy;
+		case SA:
+			return options.sa_energy;
+		default:
+			assert(!"What");
+	}
+}
+
+// Stats of a number of calls of one crossbar operation, which together
+// covered the given cells. Each call pays the latencies once, the energies
+// scale with the cells.
+inline Stats write_stats(const CrossbarOptions &options, size_t calls,
+		size_t cells) {
+	Stats stats;
+	stats.total_crossbar_time += options.write_latency * calls;
+	stats.total_crossbar_energy += options.write_energy * cells
+		* options.datatype_size;
+	stats.num_written_cells += cells;
+	return stats;
+}
+
+inline Stats read_stats(const CrossbarOptions &options, size_t calls,
+		size_t cells) {
+	Stats stats;
+	// Pattern: more adcs should decrease latency but increase
+	// energy.
+	const auto adc_activations = options.cols_per_adc *
+		options.datatype_size;
+	const auto adc_latency = adc_activations * analogue_latency(options);
+	const auto total_adc_acts = cells * options.datatype_size;
+	const auto adc_energy = total_adc_acts * analogue_energy(options);
+	const auto static_latency = options.static_latency;
+	const auto static_energy = cells * options.static_energy;
+
+	stats.total_crossbar_time += (adc_latency + options.read_latency) * calls;
+	stats.total_crossbar_energy += adc_energy +
+		cells * options.datatype_size * options.read_energy;
+	stats.total_periphery_time += static_latency * calls;
+	stats.total_periphery_energy += static_energy;
+	stats.num_read_cells += cells;
+	stats.num_adc_acts += total_adc_acts;
+	return stats;
+}
+
+inline Stats input_read_stats(const CrossbarOptions &options, size_t calls,
+		size_t cells) {
+	Stats stats;
+
+	// num will always be number of columns
+	const auto adc_activations = options.cols_per_adc *
+		options.datatype_size * options.input_size;
+	const auto adc_latency = adc_activations * analogue_latency(options);
+	const auto total_adc_acts = cells *
+		 options.datatype_size * options.input_size;
+	const auto adc_energy = total_adc_acts * analogue_energy(options);
+	const auto static_latency = options.static_latency;
+	const auto static_energy = cells * options.static_energy;
+
+	stats.total_crossbar_time += (adc_latency + options.read_latency) * calls;
+	stats.total_crossbar_energy += adc_energy +
+		cells * options.datatype_size * options.read_energy;
+	stats.total_periphery_time += static_latency * calls;
+	stats.total_periphery_energy += static_energy;
+	stats.num_read_cells += cells;
+	stats.num_adc_acts += total_adc_acts;
+	return stats;
+}
+
+// A multi-row read activates cols columns and reads cells cells in total.
+inline Stats multi_read_stats(const CrossbarOptions &options, size_t calls,
+		size_t cols, size_t cells) {
+	Stats stats;
+
+	// num will always be number of columns
+	const auto adc_activations = options.cols_per_adc *
+		options.datatype_size * options.input_size;
+	const auto adc_latency = adc_activations * analogue_latency(options);
+	const auto total_adc_acts = cols *
+		 options.datatype_size * options.input_size;
+	const auto adc_energy = total_adc_acts * analogue_energy(options);
+	const auto static_latency = options.static_latency;
+	const auto static_energy = cols * options.static_energy;
+
+	stats.total_crossbar_time += (adc_latency +
+		options.read_latency * options.input_size) * calls;
+	stats.total_crossbar_energy += adc_energy +
+		cells * options.datatype_size * options.read_energy;
+	stats.total_periphery_time += static_latency * calls;
+	stats.total_periphery_energy += static_energy;
+	stats.num_read_cells += cells;
+	stats.num_adc_acts += total_adc_acts;
+	return stats;
+}
+
+// Periphery that processes every read cell on its own, as in SparseMEM.
+inline Stats dynamic_stats(const CrossbarOptions &options, size_t cells) {
+	Stats stats;
+	stats.total_periphery_time += cells * options.dynamic_latency;
+	stats.total_periphery_energy += cells * options.dynamic_energy;
+	return stats;
+}
+
+// Stats of the counted operations under options, e.g. under other energy
+// and latency constants than the ones they were counted with.
+inline Stats counted_stats(const CrossbarOptions &options,
+		const CrossbarCounters &counters) {
+	Stats stats;
+	stats += write_stats(options, counters.writes, counters.written_cells);
+	stats += read_stats(options, counters.reads, counters.read_cells);
+	stats += input_read_stats(options, counters.input_reads,
+			counters.input_read_cells);
+	stats += multi_read_stats(options, counters.multi_reads,
+			counters.multi_read_cols, counters.multi_read_cells);
+	stats += dynamic_stats(options, counters.dynamic_cells);
+	stats.efficiency += counters.efficiency;
+	stats.num_efficiencies += counters.num_efficiencies;
+	return stats;
+}
+
+// Layout of a packed cell: bits wide, of which the low index_bits hold a
+// column index if the cell type has one.
+struct CellFormat {
+	int bits;
+	int index_bits;
+};
+
+// Weights are stored as unsigned codes of at most max_code, meaning code *
+// 2^exponent, with one exponent for each crossbar row. Weights must not be
+// negative.
+constexpr int MIN_EXPONENT = -126;
+
+inline uint64_t max_code(int bits) {
+	return (uint64_t(1) << bits) - 1;
+}
+
+// Smallest exponent at which weight fits into a code.
+inline int quantize_exponent(float weight, uint64_t max_code) {
+	assert(weight >= 0);
+	if (weight <= 0 || !max_code)
+		return MIN_EXPONENT;
+
+	auto exponent = std::max(static_cast<int>(std::ceil(std::log2(
+						weight / static_cast<float>(max_code)))),
+			MIN_EXPONENT);
+	while (std::ldexp(weight, -exponent) > static_cast<float>(max_code))
+		exponent++;
+	return exponent;
+}
+
+// Nearest code to weight.
+inline uint64_t quantize(float weight, uint64_t max_code, int exponent) {
+	const auto code = std::llround(std::ldexp(weight, -exponent));
+	return std::min<uint64_t>(std::max<long long>(code, 0), max_code);
+}
+
+// Weight of code, given the row's scale 2^exponent.
+inline float dequantize(uint64_t code, float scale) {
+	return static_cast<float>(code) * scale;
+}
+
+// Cell types that can be packed. exponent() is the smallest exponent the
+// cell's weight fits at, INT_MIN if the cell is empty. encode() gives 0 for
+// an empty cell, and decode(0) must give an empty cell, i.e. T{}. decode()
+// gets the row's scale, 2^exponent, so reads need no ldexp per cell.
+template <typename T>
+concept PackedCell = requires (const T &cell, CellFormat format,
+		uint64_t code, int exponent, float scale) {
+	{ cell.exponent(format) } -> std::same_as<int>;
+	{ cell.encode(format, exponent) } -> std::same_as<uint64_t>;
+	{ T::decode(format, code, scale) } -> std::same_as<T>;
+};
+
+// Reads return their cells in a vector allocated from resource, e.g. the
+// scratch Arena of the approach. With packed options and a PackedCell type,
+// the cells are kept as codes of datatype_size bits, so they read back
+// quantized, and a row takes datatype_size / 8 bytes per column.
 template <typename T>
 class Crossbar {
 public:
 	Crossbar(CrossbarOptions options)
-	: _options(options), _crossbar(options.num_cols * options.num_rows)
-	{}
+	: _options(options)
+	{
+		if constexpr (PackedCell<T>) {
+			_packed = options.packed;
+			_format = CellFormat{options.datatype_size,
+				static_cast<int>(std::bit_width(options.num_cols - 1))};
+		}
 
-	std::tuple<Stats, std::vector<T>> readRow(size_t row, size_t offset, size_t num) {
-		Stats stats;
-		// Pattern: more adcs should decrease latency but increase
-		// energy.
-		const auto adc_activations = _options.cols_per_adc *
-			_options.datatype_size;
-		const auto adc_latency = adc_activations * _analogue_latency();
-		const auto total_adc_acts = num * _options.datatype_size;
-		const auto adc_energy = total_adc_acts * _analogue_energy();
-		const auto static_latency = _options.static_latency;
-		const auto static_energy = num * _options.static_energy;
-
-		stats.total_crossbar_time += adc_latency + _options.read_latency;
-		stats.total_crossbar_energy += adc_energy +
-			num * _options.datatype_size * _options.read_energy;
-		stats.total_periphery_time += static_latency;
-		stats.total_periphery_energy += static_energy;
-		stats.num_read_cells += num;
-		stats.num_adc_acts += total_adc_acts;
-
-		std::vector<T> array(num);
-		std::copy(_crossbar.begin() + (row * _options.num_cols) + offset,
-				_crossbar.begin() + (row * _options.num_cols) +
-				offset + num, array.begin());
-		return std::make_tuple(stats, array);
-	}
-
-	std::tuple<Stats, std::vector<T>> readWithInput(size_t row, size_t offset, size_t num, int input) {
-		Stats stats;
+		if (!_packed) {
+			_crossbar.resize(options.num_cols * options.num_rows);
+			return;
+		}
+
+		assert(_format.bits > 0 && _format.bits <= 32);
+		_row_words = (options.num_cols * _format.bits + 63) / 64;
+		_codes.resize(_row_words * options.num_rows);
+		_scales.resize(options.num_rows);
+	}
 
-		// num will always be number of columns
-		const auto adc_activations = _options.cols_per_adc *
-			_options.datatype_size * _options.input_size;
-		const auto adc_latency = adc_activations * _analogue_latency();
-		const auto total_adc_acts = num * 
-			 _options.datatype_size * _options.input_size;
-		const auto adc_energy = total_adc_acts * _analogue_energy();
-		const auto static_latency = _options.static_latency;
-		const auto static_energy = num * _options.static_energy;
-
-		stats.total_crossbar_time += adc_latency + _options.read_latency;
-		stats.total_crossbar_energy += adc_energy +
-			num * _options.datatype_size * _options.read_energy;
-		stats.total_periphery_time += static_latency;
-		stats.total_periphery_energy += static_energy;
-		stats.num_read_cells += num;
-		stats.num_adc_acts += total_adc_acts;
-
-		std::vector<T> array(num);
-		std::copy(_crossbar.begin() + (row * _options.num_cols) + offset,
-				_crossbar.begin() + (row * _options.num_cols) +
-				offset + num, array.begin());
+	std::tuple<Stats, std::pmr::vector<T>> readRow(size_t row, size_t offset,
+			size_t num, std::pmr::memory_resource *resource =
+			std::pmr::get_default_resource()) {
+		_counters.reads++;
+		_counters.read_cells += num;
+		const auto stats = read_stats(_options, 1, num);
+
+		std::pmr::vector<T> array(num, resource);
+		_read_cells(row, offset, num, array.data());
+		return std::make_tuple(stats, std::move(array));
+	}
+
+	std::tuple<Stats, std::pmr::vector<T>> readWithInput(size_t row,
+			size_t offset, size_t num, int input,
+			std::pmr::memory_resource *resource =
+			std::pmr::get_default_resource()) {
+		_counters.input_reads++;
+		_counters.input_read_cells += num;
+		const auto stats = input_read_stats(_options, 1, num);
+
+		std::pmr::vector<T> array(num, resource);
+		_read_cells(row, offset, num, array.data());
 		std::transform(array.begin(), array.end(), array.begin(), [input] (auto a) {
 				return a + input;
 		});
-		return std::make_tuple(stats, array);
+		return std::make_tuple(stats, std::move(array));
 	}
 
-	std::tuple<Stats, std::vector<T>> multiReadWithInput(size_t row,
-			size_t num_rows, size_t col, size_t num_cols, double input) {
-		Stats stats;
+	std::tuple<Stats, std::pmr::vector<T>> multiReadWithInput(size_t row,
+			size_t num_rows, size_t col, size_t num_cols, double input,
+			std::pmr::memory_resource *resource =
+			std::pmr::get_default_resource()) {
+		_counters.multi_reads++;
+		_counters.multi_read_cols += num_cols;
+		_counters.multi_read_cells += num_cols * num_rows;
+		const auto stats = multi_read_stats(_options, 1, num_cols,
+				num_cols * num_rows);
 
-		// num will always be number of columns
-		const auto adc_activations = _options.cols_per_adc *
-			_options.datatype_size * _options.input_size;
-		const auto adc_latency = adc_activations * _analogue_latency();
-		const auto total_adc_acts = num_cols * 
-			 _options.datatype_size * _options.input_size;
-		const auto adc_energy = total_adc_acts * _analogue_energy();
-		const auto static_latency = _options.static_latency;
-		const auto static_energy = num_cols * _options.static_energy;
-
-		stats.total_crossbar_time += adc_latency +
-			_options.read_latency * _options.input_size;
-		stats.total_crossbar_energy += adc_energy +
-			num_rows * num_cols * _options.datatype_size * _options.read_energy;
-		stats.total_periphery_time += static_latency;
-		stats.total_periphery_energy += static_energy;
-		stats.num_read_cells += num_cols * num_rows;
-		stats.num_adc_acts += total_adc_acts;
-
-		std::vector<T> array(num_cols);
+		std::pmr::vector<T> array(num_cols, resource);
 		for (; row < num_rows; row++) {
-			for (size_t col_offset = col; col_offset < num_cols; col_offset++) {
-				auto index = (row * _options.num_cols) + col_offset;
-				array[col_offset] = array[col_offset] + _crossbar[index];
-			}
+			for (size_t col_offset = col; col_offset < num_cols; col_offset++)
+				array[col_offset] = array[col_offset] + _cell(row, col_offset);
 		}
 		std::transform(array.begin(), array.end(), array.begin(), [input] (auto a) {
 				return a + input;
 		});
-		return std::make_tuple(stats, array);
+		return std::make_tuple(stats, std::move(array));
 	}
 
-	Stats writeRow(size_t row, size_t offset, size_t num, const std::vector<T> &vals) {
-		Stats stats;
-
+	Stats writeRow(size_t row, size_t offset, size_t num,
+			std::span<const T> vals) {
 		assert(row < _options.num_rows);
 		assert(vals.size() == _options.num_cols);
 
-		stats.total_crossbar_time += _options.write_latency;	
-		stats.total_crossbar_energy += _options.write_energy * num
-			* _options.datatype_size;
-		stats.num_written_cells += num;
+		_counters.writes++;
+		_counters.written_cells += num;
+		const auto stats = write_stats(_options, 1, num);
 
-		std::copy(vals.begin(), vals.end(), _crossbar.begin() + row * _options.num_cols);
+		if (_packed)
+			_write_codes(row, vals);
+		else
+			std::copy(vals.begin(), vals.end(), _crossbar.begin() + row * _options.num_cols);
 		return stats;
 	}
 
 	Stats clear() {
 		Stats stats;
+		if (_packed) {
+			std::fill(_codes.begin(), _codes.end(), 0);
+			std::fill(_scales.begin(), _scales.end(), 0);
+			return stats;
+		}
 		for (auto &a : _crossbar)
 			a = T{};
 		return stats;
@@ -160,12 +382,30 @@ public:
 	template <typename F>
 	double space_efficiency(F func) {
 		size_t num_present = 0;
-		for (auto val : _crossbar)
-			if (func(val))
-				num_present++;
+		if (!_packed) {
+			for (auto val : _crossbar)
+				if (func(val))
+					num_present++;
+		} else {
+			for (size_t row = 0; row < _options.num_rows; row++) {
+				for (size_t col = 0; col < _options.num_cols; col++) {
+					auto val = _cell(row, col);
+					if (func(val))
+						num_present++;
+				}
+			}
+		}
 
-		return static_cast<double>(num_present) /
-			static_cast<double>(_crossbar.size());
+		const auto efficiency = static_cast<double>(num_present) /
+			static_cast<double>(_options.num_rows * _options.num_cols);
+		_counters.efficiency += efficiency;
+		_counters.num_efficiencies++;
+		return efficiency;
+	}
+
+	// Operations since the crossbar was created.
+	const CrossbarCounters &get_counters() const {
+		return _counters;
 	}
 
 	inline size_t get_num_rows() const {
@@ -175,30 +415,75 @@ public:
 		return _options.num_cols;
 	}
 private:
-	inline float _analogue_latency() const {
-		switch (_options.read_device) {
-			case ADC:
-				return _options.adc_latency;
-			case SA:
-				return _options.sa_latency;
-			default:
-				assert(!"What");
+	T _cell(size_t row, size_t col) const {
+		if (!_packed)
+			return _crossbar[row * _options.num_cols + col];
+		if constexpr (PackedCell<T>)
+			return T::decode(_format, _get_code(row, col), _scales[row]);
+		return T{};
+	}
+
+	void _read_cells(size_t row, size_t offset, size_t num, T *out) const {
+		if (!_packed) {
+			const auto first = _crossbar.begin() + row * _options.num_cols +
+				offset;
+			std::copy(first, first + num, out);
+			return;
 		}
+		if constexpr (PackedCell<T>) {
+			const auto scale = _scales[row];
+			for (size_t k = 0; k < num; k++)
+				out[k] = T::decode(_format, _get_code(row, offset + k),
+						scale);
+		}
+	}
+
+	// Codes of a row are packed into its own words, low bits first.
+	uint64_t _get_code(size_t row, size_t col) const {
+		const auto bit = col * _format.bits;
+		const auto *words = &_codes[row * _row_words + bit / 64];
+		const auto shift = bit % 64;
+		auto code = words[0] >> shift;
+		if (shift + _format.bits > 64)
+			code |= words[1] << (64 - shift);
+		return code & ((uint64_t(1) << _format.bits) - 1);
 	}
 
-	inline float _analogue_energy() const {
-		switch (_options.read_device) {
-			case ADC:
-				return _options.adc_energy;
-			case SA:
-				return _options.sa_energy;
-			default:
-				assert(!"What");
+	void _set_code(size_t row, size_t col, uint64_t code) {
+		const auto bit = col * _format.bits;
+		auto *words = &_codes[row * _row_words + bit / 64];
+		const auto shift = bit % 64;
+		const auto mask = (uint64_t(1) << _format.bits) - 1;
+		words[0] = (words[0] & ~(mask << shift)) | (code << shift);
+		if (shift + _format.bits > 64) {
+			const auto high = 64 - shift;
+			words[1] = (words[1] & ~(mask >> high)) | (code >> high);
+		}
+	}
+
+	// All cells of a row share the exponent of its largest weight.
+	void _write_codes(size_t row, std::span<const T> vals) {
+		if constexpr (PackedCell<T>) {
+			auto exponent = INT_MIN;
+			for (auto &val : vals)
+				exponent = std::max(exponent, val.exponent(_format));
+			if (exponent == INT_MIN)
+				exponent = 0;
+
+			_scales[row] = std::ldexp(1.0f, exponent);
+			for (size_t col = 0; col < vals.size(); col++)
+				_set_code(row, col, vals[col].encode(_format, exponent));
 		}
 	}
 
 	CrossbarOptions _options;
 	std::vector<T> _crossbar;
+	bool _packed = false;
+	CellFormat _format{};
+	size_t _row_words = 0;
+	std::vector<uint64_t> _codes;
+	std::vector<float> _scales;
+	CrossbarCounters _counters;
 };
 
 #endif // CROSSBAR_HPP
@@ -3,14 +3,41 @@
 
 #include <vector>
 #include <memory>
+#include <span>
 #include <omp.h>
 #include <optional>
 #include <limits>
 #include <stdint.h>
+#include <bit>
+#include <type_traits>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <stdexcept>
 
 #include "stats.hpp"
 #include "crossbar.hpp"
 #include "graph.hpp"
+#include "tile_queue.hpp"
+#include "profile.hpp"
+#include "shared_segment.hpp"
+#include "worker_pool.hpp"
+#include "numa.hpp"
+#include "util.hpp"
+#include "arena.hpp"
+
+// Row input of batched traversals: one bit for every query of the batch
+// that has this row in its frontier.
+struct BatchInput {
+	uint64_t mask;
+	size_t row;
+
+	size_t count() const {
+		return std::popcount(mask);
+	}
+};
 
 template <bool PageRank = false>
 class Graphr {
@@ -37,40 +64,101 @@ public:
 			return Data{weight + other.weight};
 		}
 
+		// Packed cells hold just the weight, see PackedCell. Code 0 is
+		// the empty cell, so in traversals, where that has an infinite
+		// weight, no edge rounds down to it.
+		int exponent(CellFormat format) const {
+			if (weight == Data().weight)
+				return INT_MIN;
+			return quantize_exponent(weight, max_code(format.bits));
+		}
+
+		uint64_t encode(CellFormat format, int exponent) const {
+			if (weight == Data().weight)
+				return 0;
+			const auto code = quantize(weight, max_code(format.bits),
+					exponent);
+			return PageRank ? code : std::max<uint64_t>(code, 1);
+		}
+
+		static Data decode(CellFormat, uint64_t code, float scale) {
+			if (!code)
+				return Data();
+			return Data{dequantize(code, scale)};
+		}
+
 		float weight;
 	};
 
+	using Options = CrossbarOptions;
+
 	Graphr(CrossbarOptions crossbar_options)
 	: _crossbar(crossbar_options)
 	{}
 
+	// element_func(Data &, Data &cell, col) is called for every output
+	// cell. If it can instead take element_func(Data &, std::span<Data>,
+	// first col), it gets each output row at once, so it can vectorize its
+	// update. Batched inputs always go cell by cell.
 	template<typename RowFunc, typename ElementFunc, typename Data,
 		bool MultiRow = std::is_invocable_v<RowFunc, Data&>>
 	Stats run_kernel(RowFunc row_func, ElementFunc element_func, Data &data) {
+		using Cell = typename Graphr::Data;
+		constexpr bool WholeRow = std::is_invocable_v<ElementFunc, Data&,
+			std::span<Cell>, size_t>;
+
 		Stats stats;
 		if (!populated)
 			return stats;
 
+		_arena.reset();
 		if constexpr (!MultiRow) {
 			for (size_t i = 0; i < _crossbar.get_num_rows(); i++) {
+				const Arena::Scope scope(_arena);
 				auto real_row = i + _row_offset;
 
 				auto row_input = row_func(data, real_row);
 				if (!row_input)
 					continue;
 
-				auto [read_stats, array] = _crossbar.readWithInput(
-						i, 0, _crossbar.get_num_cols(),
-						*row_input);
-				stats += read_stats;
-
-				size_t j = _col_offset;
-				for (auto elem : array) {
-					if (elem.weight < 0)
-						elem.weight = std::numeric_limits<float>::max();
-
-					element_func(data, elem, j);
-					j++;
+				if constexpr (std::is_same_v<std::remove_cvref_t<
+						decltype(*row_input)>, BatchInput>) {
+					// Each query needs its own input pulse, but the
+					// cells were programmed only once for all of them.
+					auto [read_stats, array] = _crossbar.readWithInput(
+							i, 0, _crossbar.get_num_cols(), 0, &_arena);
+					read_stats *= row_input->count();
+					stats += read_stats;
+
+					size_t j = _col_offset;
+					for (auto elem : array) {
+						if (elem.weight < 0)
+							elem.weight = std::numeric_limits<float>::max();
+
+						element_func(data, elem, j, *row_input);
+						j++;
+					}
+				} else {
+					auto [read_stats, array] = _crossbar.readWithInput(
+							i, 0, _crossbar.get_num_cols(),
+							*row_input, &_arena);
+					stats += read_stats;
+
+					if constexpr (WholeRow) {
+						_clear_negative(array);
+						element_func(data, std::span<Cell>(array),
+								_col_offset);
+					} else {
+						size_t j = _col_offset;
+						for (auto elem : array) {
+							if (elem.weight < 0)
+								elem.weight =
+									std::numeric_limits<float>::max();
+
+							element_func(data, elem, j);
+							j++;
+						}
+					}
 				}
 			}
 		} else {
@@ -81,30 +169,98 @@ public:
 			auto [read_stats, array] = _crossbar.multiReadWithInput(
 					0, _crossbar.get_num_rows(),
 					0, _crossbar.get_num_cols(),
-					*row_input);
+					*row_input, &_arena);
 			stats += read_stats;
 
-			size_t j = _col_offset;
-			for (auto elem : array) {
-				element_func(data, elem, j);
-				j++;
+			if constexpr (WholeRow) {
+				element_func(data, std::span<Cell>(array), _col_offset);
+			} else {
+				size_t j = _col_offset;
+				for (auto elem : array) {
+					element_func(data, elem, j);
+					j++;
+				}
 			}
 		}
 
 		return stats;
 	}
 
+	// Runs the kernel on a tile without the crossbar model, for the exact
+	// pass of sampled experiments. The element function sees the same
+	// values as in run_kernel, but with a row input it is only called for
+	// cells that hold an edge.
+	template<typename RowFunc, typename ElementFunc, typename Data,
+		bool MultiRow = std::is_invocable_v<RowFunc, Data&>>
+	static void run_native(RowFunc row_func, ElementFunc element_func,
+			const SubGraph &sub_graph, Data &data) {
+		using Cell = typename Graphr::Data;
+		const auto &rows = sub_graph.rows;
+		if (sub_graph.empty())
+			return;
+
+		if constexpr (!MultiRow) {
+			size_t k = 0;
+			for (size_t i = 0; i < sub_graph.dimensions; i++) {
+				const auto real_row = i + sub_graph.row_offset;
+				auto end = k;
+				while (end != rows.size() && rows[end] == i)
+					end++;
+
+				auto row_input = row_func(data, real_row);
+				for (; row_input && k != end; k++) {
+					if constexpr (std::is_same_v<std::remove_cvref_t<
+							decltype(*row_input)>, BatchInput>) {
+						auto elem = Cell{sub_graph.weight(k)} + 0;
+						if (elem.weight < 0)
+							elem.weight = std::numeric_limits<float>::max();
+						element_func(data, elem, sub_graph.col(k),
+								*row_input);
+					} else {
+						auto elem = Cell{sub_graph.weight(k)} +
+							static_cast<int>(*row_input);
+						if (elem.weight < 0)
+							elem.weight = std::numeric_limits<float>::max();
+						element_func(data, elem, sub_graph.col(k));
+					}
+				}
+				k = end;
+			}
+		} else {
+			const auto row_input = row_func(data);
+			if (!row_input)
+				return;
+
+			// Empty cells add nothing to the column sums. There is no
+			// approach, and so no arena, in a static function.
+			thread_local std::vector<Cell> sums;
+			sums.assign(sub_graph.dimensions, Cell{});
+			for (size_t k = 0; k < sub_graph.size(); k++) {
+				auto &sum = sums[sub_graph.cols[k]];
+				sum = sum + Cell{sub_graph.weight(k)};
+			}
+
+			size_t j = sub_graph.col_offset;
+			for (auto sum : sums) {
+				auto elem = sum + *row_input;
+				element_func(data, elem, j);
+				j++;
+			}
+		}
+	}
+
 	Stats expand_to_crossbar(const SubGraph &sub_graph) {
 		Stats stats;
 		const auto max_rows = _crossbar.get_num_rows();
 		const auto max_cols = _crossbar.get_num_cols();
 
 		// Optimisation
-		if (sub_graph.tuples.empty())
+		if (sub_graph.empty())
 			return stats;
 
-		std::vector<Data> vals(max_cols);
-		if (sub_graph.tuples.empty()) {
+		_arena.reset();
+		std::pmr::vector<Data> vals(max_cols, &_arena);
+		if (sub_graph.empty()) {
 			for (size_t i = 0; i < max_rows; i++)
 				stats += _crossbar.writeRow(i, 0, max_cols, vals);
 			return stats;
@@ -113,17 +269,15 @@ public:
 		_row_offset = sub_graph.row_offset;
 		_col_offset = sub_graph.col_offset;
 
-		const auto &tuples = sub_graph.tuples;
-
 		size_t row = 0;
-		for (auto &tuple : tuples) {
-			if ((tuple.i - _row_offset) != row) {
+		for (size_t k = 0; k < sub_graph.size(); k++) {
+			if (sub_graph.rows[k] != row) {
 				stats += _crossbar.writeRow(row, 0, max_cols, vals);
-				row = tuple.i - _row_offset;
+				row = sub_graph.rows[k];
 				vals.clear();
 				vals.resize(max_cols);
 			}
-			vals[tuple.j - _col_offset] = Data{tuple.weight};
+			vals[sub_graph.cols[k]] = Data{sub_graph.weight(k)};
 		}
 
 		stats += _crossbar.writeRow(row, 0, max_cols, vals);
@@ -143,12 +297,33 @@ public:
 		return stats;
 	}
 
+	// Scratch memory of run_kernel and expand_to_crossbar, which is only
+	// needed during the call and released by the next one.
+	const ArenaUsage &get_arena_usage() const {
+		return _arena.get_usage();
+	}
+
+	// Crossbar operations so far, see derive_tile_costs.
+	CrossbarCounters get_counters() const {
+		return _crossbar.get_counters();
+	}
+
 	Stats clear() {
 		populated = false;
 		return _crossbar.clear();
 	}
 private:
+	// Same as the per-cell fix up in run_kernel, as a loop that vectorizes.
+	static void _clear_negative(std::span<Data> array) {
+		#pragma omp simd
+		for (size_t k = 0; k < array.size(); k++) {
+			if (array[k].weight < 0)
+				array[k].weight = std::numeric_limits<float>::max();
+		}
+	}
+
 	Crossbar<Data> _crossbar;
+	Arena _arena;
 	size_t _row_offset = 0, _col_offset = 0;
 	bool populated = false;
 };
@@ -175,8 +350,37 @@ public:
 		: dest(dest), weight(weight)
 		{}
 
+		// Packed cells hold the weight code plus one above a column
+		// index of format.index_bits, see PackedCell, so only empty
+		// cells encode to 0.
+		int exponent(CellFormat format) const {
+			if (dest == Data().dest)
+				return INT_MIN;
+			return quantize_exponent(weight, _max_weight_code(format));
+		}
+
+		uint64_t encode(CellFormat format, int exponent) const {
+			if (dest == Data().dest)
+				return 0;
+			const auto code = quantize(weight, _max_weight_code(format),
+					exponent) + 1;
+			return code << format.index_bits | dest;
+		}
+
+		static Data decode(CellFormat format, uint64_t code, float scale) {
+			if (!code)
+				return Data();
+			const auto dest = code & max_code(format.index_bits);
+			return Data(static_cast<unsigned short>(dest),
+					dequantize((code >> format.index_bits) - 1, scale));
+		}
+
 		unsigned short dest;
 		float weight;
+	private:
+		static uint64_t _max_weight_code(CellFormat format) {
+			return max_code(format.bits - format.index_bits) - 1;
+		}
 	};
 
 	struct Offset {
@@ -192,10 +396,18 @@ public:
 		size_t start, stop;
 	};
 
+	using Options = CrossbarOptions;
+
 	SparseMEM(CrossbarOptions options)
 	: _options(options), _data_crossbar(options),
 	_offset_crossbar(options)
-	{}
+	{
+		// A weight needs at least one code besides the empty cell.
+		if (options.packed && options.datatype_size < 2 +
+				static_cast<int>(std::bit_width(options.num_cols - 1)))
+			throw std::runtime_error("packed cells leave no bits for the "
+					"weight");
+	}
 
 	template<typename RowFunc, typename ElementFunc, typename Data,
 		bool MultiRow = std::is_invocable_v<RowFunc, Data&>>
@@ -204,16 +416,22 @@ public:
 		if (!populated)
 			return stats;
 
+		_arena.reset();
 		if constexpr (!MultiRow) {
 			for (size_t i = 0; i < _data_crossbar.get_num_rows(); i++) {
+				const Arena::Scope scope(_arena);
 				auto real_row = i + _row_offset;
 
 				auto row_input = row_func(data, real_row);
 				if (!row_input)
 					continue;
 
+				// Weighted traversals also take the weight of each edge.
+				constexpr bool WithWeight = std::is_invocable_v<ElementFunc,
+					Data&, size_t, decltype(*row_input), float>;
+
 				auto [offset_stats, offset_res] = _offset_crossbar.readRow(
-						0, i, 1);
+						0, i, 1, &_arena);
 				stats += offset_stats;
 				auto offset = offset_res[0];
 				if (offset.start == std::numeric_limits<int>::max())
@@ -223,13 +441,16 @@ public:
 				auto offset_i = offset.start / _data_crossbar.get_num_cols();
 				auto offset_j = offset.start % _data_crossbar.get_num_cols();
 				auto [read_stats, read_res] = _data_crossbar.readRow(
-						offset_i, offset_j, num_edges);
+						offset_i, offset_j, num_edges, &_arena);
 				stats += read_stats;
 				_add_dynamic_stats(stats, num_edges);
 
 				for (auto elem : read_res) {
 					auto j = elem.dest + _col_offset;
-					elem_func(data, j, *row_input);
+					if constexpr (WithWeight)
+						elem_func(data, j, *row_input, elem.weight);
+					else
+						elem_func(data, j, *row_input);
 				}
 			}
 		} else {
@@ -238,8 +459,9 @@ public:
 				return stats;
 
 			for (size_t i = 0; i < _data_crossbar.get_num_rows(); i++) {
+				const Arena::Scope scope(_arena);
 				auto [offset_stats, offset_res] = _offset_crossbar.readRow(
-						0, i, 1);
+						0, i, 1, &_arena);
 				stats += offset_stats;
 				auto offset = offset_res[0];
 				if (offset.start == std::numeric_limits<int>::max())
@@ -249,7 +471,7 @@ public:
 				auto offset_i = offset.start / _data_crossbar.get_num_cols();
 				auto offset_j = offset.start % _data_crossbar.get_num_cols();
 				auto [read_stats, read_res] = _data_crossbar.readRow(
-						offset_i, offset_j, num_edges);
+						offset_i, offset_j, num_edges, &_arena);
 				stats += read_stats;
 				_add_dynamic_stats(stats, num_edges);
 
@@ -266,37 +488,81 @@ public:
 		return stats;
 	}
 
+	// Same as run_kernel without the crossbar model, see
+	// Graphr::run_native.
+	template<typename RowFunc, typename ElementFunc, typename Data,
+		bool MultiRow = std::is_invocable_v<RowFunc, Data&>>
+	static void run_native(RowFunc row_func, ElementFunc elem_func,
+			const SubGraph &sub_graph, Data &data) {
+		const auto &rows = sub_graph.rows;
+		if (sub_graph.empty())
+			return;
+
+		if constexpr (!MultiRow) {
+			size_t k = 0;
+			for (size_t i = 0; i < sub_graph.dimensions; i++) {
+				const auto real_row = i + sub_graph.row_offset;
+				auto end = k;
+				while (end != rows.size() && rows[end] == i)
+					end++;
+
+				auto row_input = row_func(data, real_row);
+				constexpr bool WithWeight = std::is_invocable_v<ElementFunc,
+					Data&, size_t, decltype(*row_input), float>;
+				for (; row_input && k != end; k++) {
+					if constexpr (WithWeight)
+						elem_func(data, sub_graph.col(k), *row_input,
+								sub_graph.weight(k));
+					else
+						elem_func(data, sub_graph.col(k), *row_input);
+				}
+				k = end;
+			}
+		} else {
+			const auto row_input = row_func(data);
+			if (!row_input)
+				return;
+
+			for (size_t k = 0; k < sub_graph.size(); k++)
+				elem_func(data, sub_graph.col(k), sub_graph.weight(k));
+
+			for (size_t j = 0; j < sub_graph.dimensions; j++)
+				elem_func(data, j + sub_graph.col_offset, *row_input);
+		}
+	}
+
 	Stats expand_to_crossbar(const SubGraph &sub_graph) {
 		Stats stats;
-		if (sub_graph.tuples.empty())
+		if (sub_graph.empty())
 			return stats;
 
 		_row_offset = sub_graph.row_offset;
 		_col_offset = sub_graph.col_offset;
 
-		const auto &tuples = sub_graph.tuples;
 		const auto max_rows = _data_crossbar.get_num_rows();
 		const auto max_cols = _data_crossbar.get_num_cols();
 
-		if (tuples.size() >= max_rows * max_cols)
+		if (sub_graph.size() >= max_rows * max_cols)
 			throw std::runtime_error("graph too large to fit into crossbar!");
 
 		size_t row = 0, column = 0;
-		std::vector<Data> vals(max_rows);
-		std::vector<Offset> offset_array(max_rows);
+		_arena.reset();
+		std::pmr::vector<Data> vals(max_rows, &_arena);
+		std::pmr::vector<Offset> offset_array(max_rows, &_arena);
 
-		std::vector<unsigned int> degrees(max_rows);
-		for (auto &tuple : tuples)
-			degrees[tuple.i - _row_offset]++;
+		std::pmr::vector<unsigned int> degrees(max_rows, &_arena);
+		for (auto i : sub_graph.rows)
+			degrees[i]++;
 
-		for (auto &tuple : tuples) {
-			auto degree = degrees[tuple.i - _row_offset];
+		for (size_t k = 0; k < sub_graph.size(); k++) {
+			const auto i = sub_graph.rows[k];
+			auto degree = degrees[i];
 			if (degree > max_rows)
 				std::cout << "too large degree: " << degree << std::endl;
 			assert(degree <= max_rows);
 
 			auto offset = row * max_rows + column;
-			if (offset_array[tuple.i - _row_offset].start == std::numeric_limits<size_t>::max()) {
+			if (offset_array[i].start == std::numeric_limits<size_t>::max()) {
 				if (degree > max_rows - column) {
 					stats += _data_crossbar.writeRow(row, 0, column + 1, vals);
 					row++;
@@ -305,15 +571,15 @@ public:
 					vals.resize(max_rows);
 				}
 				offset = row * max_rows + column;
-				offset_array[tuple.i - _row_offset] = Offset{offset, offset + degree};
+				offset_array[i] = Offset{offset, offset + degree};
 			} else {
-				assert(offset_array[tuple.i - _row_offset].stop >= offset);
+				assert(offset_array[i].stop >= offset);
 			}
-			assert(tuple.i - _row_offset < offset_array.size());
+			assert(i < offset_array.size());
 
-			assert(tuple.j - _col_offset < max_rows);
-			vals[column] = Data{static_cast<unsigned short>(tuple.j - _col_offset)
-				, tuple.weight};
+			assert(sub_graph.cols[k] < max_rows);
+			vals[column] = Data{static_cast<unsigned short>(sub_graph.cols[k])
+				, sub_graph.weight(k)};
 			column++;
 		}
 		stats += _data_crossbar.writeRow(row, 0, column, vals);
@@ -328,6 +594,17 @@ public:
 		return stats;
 	}
 
+	const ArenaUsage &get_arena_usage() const {
+		return _arena.get_usage();
+	}
+
+	CrossbarCounters get_counters() const {
+		auto counters = _data_crossbar.get_counters();
+		counters += _offset_crossbar.get_counters();
+		counters.dynamic_cells += _dynamic_cells;
+		return counters;
+	}
+
 	Stats clear() {
 		populated = false;
 
@@ -338,28 +615,98 @@ public:
 	}
 private:
 	void _add_dynamic_stats(Stats &stats, int num) {
-		stats.total_periphery_time += num * _options.dynamic_latency;
-		stats.total_periphery_energy += num * _options.dynamic_energy;
+		_dynamic_cells += num;
+		stats += dynamic_stats(_options, num);
 	}
 
 	CrossbarOptions _options;
 	Crossbar<Data> _data_crossbar;
 	Crossbar<Offset> _offset_crossbar;
+	Arena _arena;
 	size_t _row_offset = 0, _col_offset = 0;
+	uint64_t _dynamic_cells = 0;
 	bool populated = false;
 };
 
+// Simulates two approaches over a single tile stream: every tile is
+// extracted once and programmed into both. Only the primary approach calls
+// the element function and produces results, the secondary one runs with
+// a no-op and just accumulates its Stats, which are returned by
+// get_secondary_stats. Since both see the same data when reading a tile,
+// the secondary Stats match those of a separate run as long as the row
+// function only reads state the element function leaves alone.
+template <typename Primary, typename Secondary>
+class Fused {
+public:
+	using Data = typename Primary::Data;
+
+	struct Options {
+		typename Primary::Options primary;
+		typename Secondary::Options secondary;
+	};
+
+	Fused(Options options)
+	: _primary(options.primary), _secondary(options.secondary)
+	{}
+
+	template<typename RowFunc, typename ElementFunc, typename Data>
+	Stats run_kernel(RowFunc row_func, ElementFunc element_func, Data &data) {
+		_secondary_stats += _secondary.run_kernel(row_func,
+				[] (auto &&...) {}, data);
+		return _primary.run_kernel(row_func, element_func, data);
+	}
+
+	template<typename RowFunc, typename ElementFunc, typename Data>
+	static void run_native(RowFunc row_func, ElementFunc element_func,
+			const SubGraph &sub_graph, Data &data) {
+		Primary::run_native(row_func, element_func, sub_graph, data);
+	}
+
+	Stats expand_to_crossbar(const SubGraph &sub_graph) {
+		_secondary_stats += _secondary.expand_to_crossbar(sub_graph);
+		return _primary.expand_to_crossbar(sub_graph);
+	}
+
+	Stats clear() {
+		_secondary_stats += _secondary.clear();
+		return _primary.clear();
+	}
+
+	const Stats &get_secondary_stats() const {
+		return _secondary_stats;
+	}
+
+	ArenaUsage get_arena_usage() const {
+		auto usage = _primary.get_arena_usage();
+		usage += _secondary.get_arena_usage();
+		return usage;
+	}
+private:
+	Primary _primary;
+	Secondary _secondary;
+	Stats _secondary_stats;
+};
+
+// Default tile filter for Experiment::run_kernel, which keeps every tile.
+struct AllTiles {
+	template <typename Data>
+	bool operator()(size_t row, size_t col, Data &data) const {
+		return true;
+	}
+};
+
 template <typename Approach, typename Data>
 class Experiment {
 public:
 	template <typename... DataInit>
-	Experiment(CrossbarOptions crossbar_options, DataInit... data_init) :
+	Experiment(typename Approach::Options crossbar_options,
+			DataInit... data_init) :
 	_global_data(std::forward<DataInit>(data_init)...) {
 		const auto num_threads = omp_get_max_threads();
-		_local_data.resize(num_threads,
-				Data{std::forward<DataInit>(data_init)...});
 		_local_stats.resize(num_threads);
-		_approaches.resize(num_threads, crossbar_options);
+		_make_per_thread(_approaches, [&] {
+			return Approach(crossbar_options);
+		});
 	}
 
 	// Experiments should be unique.
@@ -370,52 +717,167 @@ public:
 	Experiment &operator= (Experiment &&) = default;
 
 	// Runs one full iteration of kernel on multiple crossbars.
-	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc>
+	// subgraph_func(SubGraph &, Data &) is called on every extracted tile
+	// before it is written, e.g. to attach a row scale. It must not touch
+	// the edges. tile_func(row, col, Data &) is asked about every tile of
+	// the grid before extraction; tiles it rejects are neither extracted
+	// nor simulated. Every thread works on its own copy of the data,
+	// unless owner computes is set.
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename TileFunc = AllTiles>
 	void run_kernel(RowFunc row_func, ElementFunc element_func, SubgraphFunc
-			subgraph_func) {
-		const auto num_threads = omp_get_max_threads();
+			subgraph_func, TileFunc tile_func = TileFunc{}) {
+		const auto num_threads = _num_processes > 1 ?
+			static_cast<int>(_num_processes) : omp_get_max_threads();
 
 		_local_stats.clear();
 		_local_stats.resize(num_threads);
 
-		std::fill(_local_data.begin(), _local_data.end(),
-				_global_data);
+		_in_place = _owner_computes;
+		// The copies are only made once they are needed. Those of worker
+		// processes are made when they start.
+		if (_num_processes <= 1 && !_in_place)
+			_refresh_replicas();
+
+		const auto start = omp_get_wtime();
+		if (_in_place)
+			_run_strips(row_func, element_func, subgraph_func, tile_func,
+					[] (size_t col, Data &data) {});
+		else if (_num_processes > 1) {
+			if constexpr (SharedState<Data>)
+				_run_tiles_forked(row_func, element_func,
+						subgraph_func, tile_func);
+			else
+				throw std::runtime_error("the data of this "
+						"algorithm cannot be shared between "
+						"processes");
+		}
+		else if (_sample_rate > 0)
+			_run_tiles_sampled(row_func, element_func, subgraph_func,
+					tile_func);
+		else if (_queues.empty())
+			_run_tiles(row_func, element_func, subgraph_func,
+					tile_func);
+		else
+			_run_tiles_pipelined(row_func, element_func, subgraph_func,
+					tile_func);
+		_traversal_time += omp_get_wtime() - start;
+	}
 
-		#pragma omp parallel
-		{
-			const auto t = omp_get_thread_num();
-			auto &local_data = _local_data[t];
-			auto &approach = _approaches[t];
-			auto &stats = _local_stats[t];
+	// Runs one full iteration in place: every thread owns a contiguous
+	// range of column strips and runs all tiles of a strip, in ascending
+	// row block order, directly against the shared data. Since a thread is
+	// the only writer of its destination columns, no per-thread copies are
+	// made. strip_func(col, Data &) is called by the owner as soon as all
+	// tiles of strip col have run, so tiles processed later in the sweep
+	// can observe its results.
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename StripFunc>
+	void run_kernel_in_place(RowFunc row_func, ElementFunc element_func,
+			SubgraphFunc subgraph_func, StripFunc strip_func) {
+		const auto num_threads = omp_get_max_threads();
 
-			const auto num_subgraphs = _graph->get_num_subgraphs();
-			auto subgraphs_per_t = num_subgraphs / num_threads;
-			if (t == num_threads - 1)
-				subgraphs_per_t += num_subgraphs % num_threads;
-			
-			for (size_t i = 0; i < subgraphs_per_t; i++) {
-				const auto index = i + subgraphs_per_t * t;
-				const auto subgraph = _graph->get_subgraph_at(index);
+		_local_stats.clear();
+		_local_stats.resize(num_threads);
+		_in_place = true;
 
-				stats += approach.clear();
-				stats += approach.expand_to_crossbar(
-						subgraph_func(subgraph, local_data));
-				stats += approach.run_kernel(row_func,
-						element_func, local_data);
-			}
-		}
+		const auto start = omp_get_wtime();
+		_run_strips(row_func, element_func, subgraph_func, AllTiles{},
+				strip_func);
+		_traversal_time += omp_get_wtime() - start;
 	}
 
+	// With owner computes, run_kernel walks the tiles like
+	// run_kernel_in_place, without a strip function. The element function
+	// may then only write state of its destination column, and state read
+	// by the row function may change during the sweep. It takes precedence
+	// over sampling and the pipeline.
+	inline void set_owner_computes(bool owner_computes) {
+		_owner_computes = owner_computes;
+	}
+
+	// With more than one process, run_kernel runs the tiles in that many
+	// worker processes instead of threads. Every worker takes a chunk of
+	// the traversal like a thread would, and runs it single-threaded on
+	// its snapshot of the whole process, so the graph is shared with the
+	// parent's pages. Workers are forked by the first run_kernel and kept
+	// for later ones with the same functions, until the graph, the tile
+	// order or the number of processes change, or the Experiment is gone.
+	// Before every step a worker gets the state of the global data
+	// through a shared segment, afterwards its state goes back along with
+	// its Stats, and aggregate_data merges the copies as usual. Data has
+	// to be a SharedState listing every member that the tiles read or
+	// change and that may differ between iterations. Anything else the
+	// functions capture must stay the same, or live in a SharedSegment.
+	// Owner computes takes precedence, sampling and the pipeline are not
+	// supported.
+	inline void set_processes(size_t num_processes) {
+		_num_processes = num_processes;
+		_workers.stop();
+	}
+
+	// Merges the Stats of the last iteration and calls
+	// f(global data, per-thread data). After an in-place iteration there
+	// are no per-thread copies and f gets an empty vector.
 	template <typename F>
 	bool aggregate_data(F f) {
 		for (auto &stats : _local_stats)
 			_global_stats += stats;
 
-		return f(_global_data, _local_data);
+		const auto is_active = profile_phase(Phase::Aggregate, [&] {
+			if (_in_place)
+				return f(_global_data, std::vector<Data>{});
+			return f(_global_data, _local_data);
+		});
+		Profiler::get().end_iteration();
+		return is_active;
 	}
 
 	inline void set_graph(std::shared_ptr<Graph> graph) {
+		_workers.stop();
 		_graph = graph;
+		_strips.clear();
+		_schedule = _graph->get_subgraph_order(_tile_order);
+		if (_sample_rate > 0)
+			_tile_sizes = _graph->get_subgraph_sizes();
+	}
+
+	// With a non-zero rate run_kernel only simulates a random sample of
+	// the non-empty tiles, stratified by log2 of their edge count, and
+	// takes at least two tiles of every stratum. The Stats of the
+	// iteration are estimated from the sample, while the algorithm state
+	// is advanced by an exact native pass over all tiles. Not supported
+	// by run_kernel_in_place.
+	void set_sampling(double rate, uint64_t seed = 1) {
+		assert(rate >= 0 && rate <= 1);
+		_sample_rate = rate;
+		_rng.seed(seed);
+		if (_graph && _sample_rate > 0)
+			_tile_sizes = _graph->get_subgraph_sizes();
+	}
+
+	inline void set_tile_order(TileOrder order) {
+		_workers.stop();
+		_tile_order = order;
+		if (_graph)
+			_schedule = _graph->get_subgraph_order(_tile_order);
+	}
+
+	// With a non-zero depth every kernel thread gets a producer thread
+	// which extracts and prepares up to depth tiles ahead of it.
+	void set_pipeline_depth(size_t depth) {
+		_queues.clear();
+		if (!depth)
+			return;
+
+		const auto num_threads = omp_get_max_threads();
+		for (int t = 0; t < num_threads; t++)
+			_queues.push_back(std::make_unique<TileQueue<SubGraph>>(depth));
+	}
+
+	// Wall-clock seconds spent walking the tiles in run_kernel.
+	double get_traversal_time() const {
+		return _traversal_time;
 	}
 
 	Data &get_data() {
@@ -425,13 +887,506 @@ public:
 	Stats &get_stats() {
 		return _global_stats;
 	}
+
+	const std::vector<CacheAligned<Approach>> &get_approaches() const {
+		return _approaches;
+	}
+
+	// Scratch memory of all threads. Once every thread has seen its
+	// largest tile, tiles no longer allocate from the heap.
+	ArenaUsage get_arena_usage() const {
+		ArenaUsage usage;
+		for (auto &approach : _approaches)
+			usage += approach.get_arena_usage();
+		return usage;
+	}
+
+	// Estimate over all sampled iterations, get_stats returns its totals.
+	const StatsEstimate &get_estimate() const {
+		return _estimate;
+	}
+
+	size_t get_num_sampled_tiles() const {
+		return _num_sampled_tiles;
+	}
+
+	size_t get_num_estimated_tiles() const {
+		return _num_estimated_tiles;
+	}
 private:
+	struct Strip {
+		size_t col;
+		std::vector<size_t> indices;
+	};
+
+	// Groups all subgraph indices by column strip, rows ascending.
+	std::vector<Strip> _get_strips() const {
+		auto order = _graph->get_subgraph_order(TileOrder::ColumnMajor);
+		std::stable_sort(order.begin(), order.end(),
+				[this] (size_t a, size_t b) {
+			return _graph->get_subgraph_col(a) < _graph->get_subgraph_col(b);
+		});
+
+		std::vector<Strip> strips;
+		for (auto index : order) {
+			const auto col = _graph->get_subgraph_col(index);
+			if (strips.empty() || strips.back().col != col)
+				strips.push_back(Strip{col, {}});
+			strips.back().indices.push_back(index);
+		}
+
+		for (auto &strip : strips)
+			std::stable_sort(strip.indices.begin(), strip.indices.end(),
+					[this] (size_t a, size_t b) {
+				return _graph->get_subgraph_row(a) <
+					_graph->get_subgraph_row(b);
+			});
+		return strips;
+	}
+
+	// Every thread owns a contiguous range of column strips and runs the
+	// tiles tile_func keeps directly against the global data.
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename TileFunc, typename StripFunc>
+	void _run_strips(RowFunc row_func, ElementFunc element_func,
+			SubgraphFunc subgraph_func, TileFunc tile_func,
+			StripFunc strip_func) {
+		const auto num_threads = omp_get_max_threads();
+
+		if (_strips.empty())
+			_strips = _get_strips();
+
+		#pragma omp parallel
+		{
+			const auto t = omp_get_thread_num();
+			auto &approach = _approaches[t];
+			auto &stats = _local_stats[t];
+
+			const auto first = (_strips.size() / num_threads) * t;
+			auto last = first + _strips.size() / num_threads;
+			if (t == num_threads - 1)
+				last = _strips.size();
+
+			SubGraph subgraph;
+			for (size_t s = first; s < last; s++) {
+				for (auto index : _strips[s].indices) {
+					if (!tile_func(_graph->get_subgraph_row(index),
+								_strips[s].col, _global_data))
+						continue;
+
+					profile_phase(Phase::Extract, [&] {
+						_graph->get_subgraph_at(index, subgraph);
+					});
+
+					stats += approach.clear();
+					profile_phase(Phase::Subgraph, [&] {
+						subgraph_func(subgraph, _global_data);
+					});
+					stats += profile_phase(Phase::Expand, [&] {
+						return approach.expand_to_crossbar(subgraph);
+					});
+					stats += profile_phase(Phase::Kernel, [&] {
+						return approach.run_kernel(row_func,
+								element_func, _global_data);
+					});
+				}
+				strip_func(_strips[s].col, _global_data);
+			}
+			_wait_at_barrier();
+		}
+	}
+
+	// Fills values with one element per thread, made by make() on that
+	// thread. Memory is placed on the node of the thread that first
+	// touches it, so the element's buffers end up next to their user.
+	template <typename T, typename Make>
+	static void _make_per_thread(std::vector<T> &values, Make make) {
+		const auto num_threads = omp_get_max_threads();
+		std::vector<std::optional<T>> made(num_threads);
+		#pragma omp parallel
+		made[omp_get_thread_num()].emplace(make());
+
+		values.clear();
+		values.reserve(num_threads);
+		for (auto &value : made)
+			values.push_back(std::move(*value));
+	}
+
+	// Every thread refreshes its own copy of the global data, which keeps
+	// the copy on its node and spreads the copying over all threads.
+	void _refresh_replicas() {
+		const auto num_threads = omp_get_max_threads();
+		if (_local_data.size() != static_cast<size_t>(num_threads)) {
+			_make_per_thread(_local_data, [this] {
+				return _global_data;
+			});
+			return;
+		}
+
+		#pragma omp parallel
+		_local_data[omp_get_thread_num()] = _global_data;
+	}
+
+	// Every thread takes a contiguous chunk of the traversal order, the
+	// last one also takes the remainder.
+	std::pair<size_t, size_t> _get_chunk(size_t t, size_t num_threads) const {
+		const auto num_subgraphs = _schedule.size();
+		const auto first = (num_subgraphs / num_threads) * t;
+		auto last = first + num_subgraphs / num_threads;
+		if (t == num_threads - 1)
+			last = num_subgraphs;
+		return {first, last};
+	}
+
+	bool _keep_tile(size_t i, auto &tile_func, Data &data) const {
+		return tile_func(_graph->get_subgraph_row(_schedule[i]),
+				_graph->get_subgraph_col(_schedule[i]), data);
+	}
+
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename TileFunc>
+	void _run_tiles(RowFunc row_func, ElementFunc element_func,
+			SubgraphFunc subgraph_func, TileFunc tile_func) {
+		const auto num_threads = omp_get_max_threads();
+
+		#pragma omp parallel
+		{
+			const auto t = omp_get_thread_num();
+			auto &local_data = _local_data[t];
+			auto &approach = _approaches[t];
+			auto &stats = _local_stats[t];
+
+			SubGraph subgraph;
+			const auto [first, last] = _get_chunk(t, num_threads);
+			for (size_t i = first; i < last; i++) {
+				if (!_keep_tile(i, tile_func, local_data))
+					continue;
+
+				profile_phase(Phase::Extract, [&] {
+					_graph->get_subgraph_at(_schedule[i], subgraph);
+				});
+
+				stats += approach.clear();
+				profile_phase(Phase::Subgraph, [&] {
+					subgraph_func(subgraph, local_data);
+				});
+				stats += profile_phase(Phase::Expand, [&] {
+					return approach.expand_to_crossbar(subgraph);
+				});
+				stats += profile_phase(Phase::Kernel, [&] {
+					return approach.run_kernel(row_func,
+							element_func, local_data);
+				});
+			}
+			_wait_at_barrier();
+		}
+	}
+
+	// Threads come in pairs: the odd one extracts tiles and runs
+	// subgraph_func, the even one programs and reads the crossbars. The
+	// producer shares the consumer's data, so subgraph_func may only read
+	// state that the row and element functions leave alone. The consumer
+	// runs on the CPU of thread t, which first touched the shard's state,
+	// the producer on another CPU of its node. Both go back to the CPU of
+	// their own number for the next team. If pinning fails, the pipeline
+	// stays where it is from then on. If OpenMP gives a smaller team, a
+	// thread would wait for its missing partner forever, so the tiles run
+	// without the pipeline instead, also in later iterations.
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename TileFunc>
+	void _run_tiles_pipelined(RowFunc row_func, ElementFunc element_func,
+			SubgraphFunc subgraph_func, TileFunc tile_func) {
+		const auto num_threads = static_cast<int>(_queues.size());
+		bool pin_failed = false;
+		int team_size = 0;
+
+		#pragma omp parallel num_threads(2 * num_threads) \
+			reduction(||:pin_failed)
+		{
+			#pragma omp single
+			team_size = omp_get_num_threads();
+			if (team_size == 2 * num_threads)
+				_run_pipeline_pair(row_func, element_func,
+						subgraph_func, tile_func, pin_failed);
+		}
+
+		if (pin_failed) {
+			std::cout << "Cannot pin the pipeline threads, running them "
+				"unpinned" << std::endl;
+			_pin_pipeline = false;
+		}
+
+		if (team_size != 2 * num_threads) {
+			std::cout << "Pipeline needs " << 2 * num_threads
+				<< " threads but got " << team_size
+				<< ", running without it" << std::endl;
+			_queues.clear();
+			_run_tiles(row_func, element_func, subgraph_func, tile_func);
+		}
+	}
+
+	// One thread of a pair in _run_tiles_pipelined.
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename TileFunc>
+	void _run_pipeline_pair(RowFunc &row_func, ElementFunc &element_func,
+			SubgraphFunc &subgraph_func, TileFunc &tile_func,
+			bool &pin_failed) {
+		const auto num_threads = static_cast<int>(_queues.size());
+		const auto t = omp_get_thread_num() / 2;
+		const bool producer = omp_get_thread_num() % 2;
+		if (_pin_pipeline) {
+			try {
+				if (producer)
+					pin_current_helper(t, num_threads);
+				else
+					pin_current_thread(t);
+			} catch (const std::runtime_error &) {
+				pin_failed = true;
+			}
+		}
+		auto &queue = *_queues[t];
+		auto &local_data = _local_data[t];
+
+		const auto [first, last] = _get_chunk(t, num_threads);
+		// Both sides agree on the tiles to skip, the filter only
+		// reads state the kernels leave alone.
+		if (producer) {
+			for (size_t i = first; i < last; i++) {
+				if (!_keep_tile(i, tile_func, local_data))
+					continue;
+
+				SubGraph *slot;
+				while (!(slot = queue.acquire()))
+					std::this_thread::yield();
+
+				profile_phase(Phase::Extract, [&] {
+					_graph->get_subgraph_at(_schedule[i], *slot);
+				});
+				profile_phase(Phase::Subgraph, [&] {
+					subgraph_func(*slot, local_data);
+				});
+				queue.publish();
+			}
+		} else {
+			auto &approach = _approaches[t];
+			auto &stats = _local_stats[t];
+			for (size_t i = first; i < last; i++) {
+				if (!_keep_tile(i, tile_func, local_data))
+					continue;
+
+				SubGraph *slot;
+				while (!(slot = queue.front()))
+					std::this_thread::yield();
+
+				stats += approach.clear();
+				stats += profile_phase(Phase::Expand, [&] {
+					return approach.expand_to_crossbar(*slot);
+				});
+				stats += profile_phase(Phase::Kernel, [&] {
+					return approach.run_kernel(row_func,
+							element_func, local_data);
+				});
+				queue.release();
+			}
+		}
+		_wait_at_barrier();
+		if (_pin_pipeline) {
+			try {
+				pin_current_thread(omp_get_thread_num());
+			} catch (const std::runtime_error &) {
+				pin_failed = true;
+			}
+		}
+	}
+
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename TileFunc>
+	void _run_tiles_sampled(RowFunc row_func, ElementFunc element_func,
+			SubgraphFunc subgraph_func, TileFunc tile_func) {
+		const auto num_threads = omp_get_max_threads();
+
+		// Empty tiles are neither written nor read.
+		std::vector<std::vector<size_t>> strata;
+		for (size_t i = 0; i < _schedule.size(); i++) {
+			const auto size = _tile_sizes[_schedule[i]];
+			if (!size || !_keep_tile(i, tile_func, _global_data))
+				continue;
+
+			const auto stratum = std::bit_width(size);
+			if (strata.size() <= stratum)
+				strata.resize(stratum + 1);
+			strata[stratum].push_back(_schedule[i]);
+		}
+
+		std::vector<size_t> samples;
+		std::vector<size_t> strata_ends;
+		for (auto &tiles : strata) {
+			const auto population = tiles.size();
+			auto num_samples = static_cast<size_t>(
+					std::ceil(_sample_rate * population));
+			num_samples = std::clamp(num_samples,
+					std::min<size_t>(population, 2), population);
+
+			for (size_t k = 0; k < num_samples; k++) {
+				std::swap(tiles[k],
+						tiles[k + _rng() % (population - k)]);
+				samples.push_back(tiles[k]);
+			}
+			strata_ends.push_back(samples.size());
+		}
+
+		std::vector<Stats> sample_stats(samples.size());
+
+		#pragma omp parallel
+		{
+			const auto t = omp_get_thread_num();
+			auto &local_data = _local_data[t];
+			auto &approach = _approaches[t];
+
+			SubGraph subgraph;
+			#pragma omp for schedule(dynamic, 1)
+			for (size_t k = 0; k < samples.size(); k++) {
+				_graph->get_subgraph_at(samples[k], subgraph);
+
+				auto stats = approach.clear();
+				subgraph_func(subgraph, local_data);
+				stats += approach.expand_to_crossbar(subgraph);
+				stats += approach.run_kernel(row_func,
+						[] (auto &&...) {}, local_data);
+				sample_stats[k] = stats;
+			}
+
+			const auto [first, last] = _get_chunk(t, num_threads);
+			for (size_t i = first; i < last; i++) {
+				if (!_tile_sizes[_schedule[i]] ||
+						!_keep_tile(i, tile_func, local_data))
+					continue;
+
+				profile_phase(Phase::Extract, [&] {
+					_graph->get_subgraph_at(_schedule[i], subgraph);
+				});
+				subgraph_func(subgraph, local_data);
+				profile_phase(Phase::Kernel, [&] {
+					Approach::run_native(row_func, element_func,
+							subgraph, local_data);
+				});
+			}
+			_wait_at_barrier();
+		}
+
+		StatsEstimate estimate;
+		size_t begin = 0;
+		for (size_t stratum = 0; stratum < strata.size(); stratum++) {
+			const auto end = strata_ends[stratum];
+			estimate.add_stratum(strata[stratum].size(),
+					std::vector<Stats>(sample_stats.begin() + begin,
+						sample_stats.begin() + end));
+			_num_estimated_tiles += strata[stratum].size();
+			begin = end;
+		}
+		_num_sampled_tiles += samples.size();
+		_estimate += estimate;
+		_local_stats[0] = estimate.get_stats();
+	}
+
+	template <typename RowFunc, typename ElementFunc, typename SubgraphFunc,
+		typename TileFunc>
+	void _run_tiles_forked(RowFunc row_func, ElementFunc element_func,
+			SubgraphFunc subgraph_func, TileFunc tile_func) {
+		const auto num_processes = _num_processes;
+
+		size_t state_size = 0;
+		StateSize sizer{state_size};
+		visit_state(_global_data, sizer);
+
+		// Workers keep the functions they were started with, so other
+		// functions need new ones.
+		static const char key = 0;
+		if (!_workers.is_running() || _workers_key != &key ||
+				_workers_state_size != state_size) {
+			_local_data.assign(num_processes, _global_data);
+			_workers.start(num_processes, state_size,
+					sizeof(Stats) + state_size, [&] (size_t p) {
+				// The worker's global data is its copy, updated
+				// from the parent's before every step.
+				auto &data = _global_data;
+				StateReader reader{_workers.get_shared()};
+				visit_state(data, reader);
+
+				auto &approach = _approaches[0];
+				Stats stats;
+				SubGraph subgraph;
+				const auto [first, last] = _get_chunk(p, num_processes);
+				for (size_t i = first; i < last; i++) {
+					if (!_keep_tile(i, tile_func, data))
+						continue;
+
+					_graph->get_subgraph_at(_schedule[i], subgraph);
+					stats += approach.clear();
+					subgraph_func(subgraph, data);
+					stats += approach.expand_to_crossbar(subgraph);
+					stats += approach.run_kernel(row_func,
+							element_func, data);
+				}
+
+				auto *slot = _workers.get_slot(p);
+				memcpy(slot, &stats, sizeof(Stats));
+				StateWriter writer{slot + sizeof(Stats)};
+				visit_state(data, writer);
+			});
+			_workers_key = &key;
+			_workers_state_size = state_size;
+		}
+
+		StateWriter writer{_workers.get_shared()};
+		visit_state(_global_data, writer);
+		_workers.run();
+
+		for (size_t p = 0; p < num_processes; p++) {
+			const auto *slot = _workers.get_slot(p);
+			memcpy(static_cast<Stats *>(&_local_stats[p]), slot,
+					sizeof(Stats));
+			StateReader reader{slot + sizeof(Stats)};
+			visit_state(_local_data[p], reader);
+		}
+	}
+
+	// Makes the time threads spend waiting for the slowest one visible
+	// to the profiler, ahead of the implicit barrier.
+	void _wait_at_barrier() {
+		if (!Profiler::get().is_enabled())
+			return;
+
+		ScopedPhase phase(Phase::Barrier);
+		#pragma omp barrier
+	}
+
 	std::shared_ptr<Graph> _graph;
+	TileOrder _tile_order = TileOrder::ColumnMajor;
+	std::vector<size_t> _schedule;
+	std::vector<Strip> _strips;
+	bool _in_place = false;
+	bool _owner_computes = false;
+	size_t _num_processes = 1;
+	WorkerPool _workers;
+	// Identifies the functions and the size of the state the workers
+	// were started with.
+	const void *_workers_key = nullptr;
+	size_t _workers_state_size = 0;
+	double _traversal_time = 0;
 	Data _global_data;
 	Stats _global_stats;
 	std::vector<Data> _local_data;
-	std::vector<Stats> _local_stats;
-	std::vector<Approach> _approaches;
+	std::vector<CacheAligned<Stats>> _local_stats;
+	std::vector<CacheAligned<Approach>> _approaches;
+	std::vector<std::unique_ptr<TileQueue<SubGraph>>> _queues;
+	// Cleared once pinning a pipeline thread failed.
+	bool _pin_pipeline = true;
+	double _sample_rate = 0;
+	std::mt19937_64 _rng;
+	std::vector<size_t> _tile_sizes;
+	StatsEstimate _estimate;
+	size_t _num_sampled_tiles = 0, _num_estimated_tiles = 0;
 };
 
 #endif // EXPERIMENTS_HPP
@@ -0,0 +1,168 @@
+#ifndef FRONTIER_HPP
+#define FRONTIER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <tuple>
+#include <vector>
+
+// Set of vertices, kept as a word-packed bitset. While it holds at most one
+// vertex per 64 it also keeps a list of its members, so clearing, merging and
+// walking a small frontier costs O(members) instead of O(vertices). Once the
+// list overflows the frontier is dense and those operations go over the
+// words.
+class Frontier {
+public:
+	Frontier() = default;
+
+	// Holds the vertices [0, size). any_in_block asks about aligned blocks
+	// of block_size vertices, which has to be a multiple of 64.
+	Frontier(size_t size, size_t block_size)
+	: _block_words(block_size / 64), _words((size + 63) / 64),
+	_list(std::max<size_t>(size / 64, 1))
+	{
+		assert(block_size && block_size % 64 == 0);
+	}
+
+	bool test(size_t v) const {
+		return (_words[v / 64] >> (v % 64)) & 1;
+	}
+
+	// May be called concurrently, also with any_in_block and test on
+	// other words.
+	void insert(size_t v) {
+		const auto bit = uint64_t(1) << (v % 64);
+		std::atomic_ref<uint64_t> word(_words[v / 64]);
+		if (word.fetch_or(bit, std::memory_order_relaxed) & bit)
+			return;
+
+		const auto k = std::atomic_ref<size_t>(_count).fetch_add(1,
+				std::memory_order_relaxed);
+		if (k < _list.size())
+			_list[k] = v;
+	}
+
+	// Inserts first + b for every set bit b, first being a multiple of 64.
+	// May be called concurrently like insert.
+	void insert_bits(size_t first, uint64_t bits) {
+		assert(first % 64 == 0);
+		if (!bits)
+			return;
+
+		std::atomic_ref<uint64_t> word(_words[first / 64]);
+		auto added = bits & ~word.fetch_or(bits, std::memory_order_relaxed);
+		if (!added)
+			return;
+
+		auto k = std::atomic_ref<size_t>(_count).fetch_add(
+				std::popcount(added), std::memory_order_relaxed);
+		for (; added && k < _list.size(); added &= added - 1, k++)
+			_list[k] = first + std::countr_zero(added);
+	}
+
+	bool any_in_block(size_t block) const {
+		const auto first = block * _block_words;
+		const auto last = std::min(first + _block_words, _words.size());
+		uint64_t any = 0;
+		for (size_t k = first; k < last; k++)
+			any |= _words[k];
+		return any;
+	}
+
+	size_t count() const {
+		return _count;
+	}
+
+	bool empty() const {
+		return !_count;
+	}
+
+	bool is_sparse() const {
+		return _count <= _list.size();
+	}
+
+	void clear() {
+		if (is_sparse()) {
+			for (size_t k = 0; k < _count; k++)
+				_words[_list[k] / 64] = 0;
+		} else {
+			std::fill(_words.begin(), _words.end(), 0);
+		}
+		_count = 0;
+	}
+
+	// Adds all members of other, which must have the same size. Unlike
+	// insert, this must not run concurrently.
+	void merge(const Frontier &other) {
+		assert(_words.size() == other._words.size());
+		if (other.is_sparse()) {
+			for (size_t k = 0; k < other._count; k++) {
+				const auto v = other._list[k];
+				const auto bit = uint64_t(1) << (v % 64);
+				if (_words[v / 64] & bit)
+					continue;
+				_words[v / 64] |= bit;
+				if (_count < _list.size())
+					_list[_count] = v;
+				_count++;
+			}
+			return;
+		}
+
+		size_t count = 0;
+		#pragma omp simd reduction(+:count)
+		for (size_t k = 0; k < _words.size(); k++) {
+			_words[k] |= other._words[k];
+			count += std::popcount(_words[k]);
+		}
+		_count = count;
+		if (is_sparse())
+			_fill_list();
+	}
+
+	// Calls f(v) for every member, in ascending order if dense.
+	template <typename F>
+	void for_each(F f) const {
+		if (is_sparse()) {
+			for (size_t k = 0; k < _count; k++)
+				f(_list[k]);
+			return;
+		}
+
+		for (size_t k = 0; k < _words.size(); k++) {
+			auto word = _words[k];
+			while (word) {
+				f(k * 64 + std::countr_zero(word));
+				word &= word - 1;
+			}
+		}
+	}
+
+	// See Experiment::set_processes.
+	auto state() {
+		return std::tie(_count, _words, _list);
+	}
+private:
+	void _fill_list() {
+		size_t n = 0;
+		for (size_t k = 0; k < _words.size(); k++) {
+			auto word = _words[k];
+			while (word) {
+				_list[n++] = k * 64 + std::countr_zero(word);
+				word &= word - 1;
+			}
+		}
+	}
+
+	size_t _block_words = 0;
+	size_t _count = 0;
+	std::vector<uint64_t> _words;
+	// Valid up to _count while the frontier is sparse.
+	std::vector<size_t> _list;
+};
+
+#endif // FRONTIER_HPP
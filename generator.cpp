@@ -0,0 +1,204 @@
+#include "generator.hpp"
+#include "profile.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <parallel/algorithm>
+
+namespace {
+	constexpr size_t CHUNK_SIZE = 1 << 16;
+	constexpr unsigned int MAX_SCALE = 40;
+
+	inline uint64_t mix(uint64_t x) {
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return x;
+	}
+
+	// Uniform in [0, 1), computed from the raw bits so the stream is the
+	// same with every standard library.
+	inline double uniform(std::mt19937_64 &rng) {
+		return (rng() >> 11) * 0x1.0p-53;
+	}
+
+	// Source and destination of a random edge.
+	std::pair<size_t, size_t> rmat_edge(const GeneratorOptions &options,
+			std::mt19937_64 &rng) {
+		const auto ab = options.a + options.b;
+		const auto abc = ab + options.c;
+
+		size_t i = 0, j = 0;
+		for (unsigned int level = 0; level < options.scale; level++) {
+			const auto r = uniform(rng);
+			i <<= 1;
+			j <<= 1;
+			if (r < options.a)
+				continue;
+			if (r < ab)
+				j |= 1;
+			else if (r < abc)
+				i |= 1;
+			else {
+				i |= 1;
+				j |= 1;
+			}
+		}
+		return {i, j};
+	}
+
+	std::pair<size_t, size_t> uniform_edge(const GeneratorOptions &options,
+			std::mt19937_64 &rng) {
+		const auto shift = 64 - options.scale;
+		const size_t i = rng() >> shift;
+		const size_t j = rng() >> shift;
+		return {i, j};
+	}
+
+	// Edges are sorted and deduplicated as keys that compare column-major,
+	// then unpacked into the Graph's arrays. Two 32-bit ids share one
+	// integer, so an edge takes at most 16 bytes on the way.
+	template <typename Id>
+	using EdgeKey = std::conditional_t<sizeof(Id) == sizeof(uint32_t),
+		uint64_t, std::pair<uint64_t, uint64_t>>;
+
+	template <typename Id>
+	EdgeKey<Id> make_key(size_t i, size_t j) {
+		if constexpr (sizeof(Id) == sizeof(uint32_t))
+			return (uint64_t(j) << 32) | i;
+		else
+			return {j, i};
+	}
+
+	size_t key_src(uint64_t key) {
+		return key & std::numeric_limits<uint32_t>::max();
+	}
+
+	size_t key_dst(uint64_t key) {
+		return key >> 32;
+	}
+
+	size_t key_src(const std::pair<uint64_t, uint64_t> &key) {
+		return key.second;
+	}
+
+	size_t key_dst(const std::pair<uint64_t, uint64_t> &key) {
+		return key.first;
+	}
+
+	template <typename Id>
+	Graph generate_edges(const GeneratorOptions &options, size_t dimensions,
+			size_t max_row, size_t max_col) {
+		const auto num_edges = options.edge_factor * dimensions;
+		const auto num_chunks = (num_edges + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+		std::vector<EdgeKey<Id>> keys(num_edges);
+
+		profile_phase(Phase::Load, [&] {
+			#pragma omp parallel for schedule(dynamic, 1)
+			for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+				std::mt19937_64 rng(mix(options.seed ^ mix(chunk)));
+
+				const auto first = chunk * CHUNK_SIZE;
+				const auto last = std::min(first + CHUNK_SIZE, num_edges);
+				for (size_t k = first; k < last; k++) {
+					std::pair<size_t, size_t> edge;
+					if (options.model == GraphModel::RMAT)
+						edge = rmat_edge(options, rng);
+					else
+						edge = uniform_edge(options, rng);
+					keys[k] = make_key<Id>(edge.first, edge.second);
+				}
+			}
+		});
+
+		// Crossbars hold at most one cell per edge, so the graph has to
+		// be simple. Sorting column-major also saves the Graph its own
+		// sort.
+		EdgeArrays<Id> edges;
+		profile_phase(Phase::Sort, [&] {
+			__gnu_parallel::sort(keys.begin(), keys.end());
+			auto last = std::unique(keys.begin(), keys.end());
+			last = std::remove_if(keys.begin(), last,
+					[] (const EdgeKey<Id> &key) {
+				return key_src(key) == key_dst(key);
+			});
+
+			const size_t n = last - keys.begin();
+			edges.src.resize(n);
+			edges.dst.resize(n);
+			#pragma omp parallel for
+			for (size_t k = 0; k < n; k++) {
+				edges.src[k] = key_src(keys[k]);
+				edges.dst[k] = key_dst(keys[k]);
+			}
+			keys = std::vector<EdgeKey<Id>>();
+		});
+
+		return Graph(std::move(edges), dimensions, max_row, max_col);
+	}
+}
+
+std::optional<GeneratorOptions> parse_generator(const std::string &spec) {
+	std::vector<std::string> fields;
+	size_t pos = 0;
+	while (pos <= spec.size()) {
+		auto end = spec.find(':', pos);
+		if (end == std::string::npos)
+			end = spec.size();
+		fields.push_back(spec.substr(pos, end - pos));
+		pos = end + 1;
+	}
+	if (fields.size() < 2 || fields.size() > 4)
+		return std::nullopt;
+
+	GeneratorOptions options;
+	if (fields[0] == "rmat")
+		options.model = GraphModel::RMAT;
+	else if (fields[0] == "er")
+		options.model = GraphModel::ErdosRenyi;
+	else
+		return std::nullopt;
+
+	try {
+		options.scale = std::stoul(fields[1]);
+		if (fields.size() > 2)
+			options.edge_factor = std::stoul(fields[2]);
+		if (fields.size() > 3)
+			options.seed = std::stoull(fields[3]);
+	} catch (const std::exception &) {
+		return std::nullopt;
+	}
+
+	if (!options.scale || options.scale > MAX_SCALE || !options.edge_factor)
+		return std::nullopt;
+	return options;
+}
+
+const char *graph_model_name(GraphModel model) {
+	switch (model) {
+		case GraphModel::RMAT:
+			return "rmat";
+		case GraphModel::ErdosRenyi:
+			return "er";
+	}
+	return "unknown";
+}
+
+Graph generate_graph(const GeneratorOptions &options, size_t max_row,
+		size_t max_col) {
+	assert(options.scale && options.scale <= MAX_SCALE);
+
+	const size_t dimensions = size_t(1) << options.scale;
+	if (dimensions > size_t(std::numeric_limits<uint32_t>::max()) + 1)
+		return generate_edges<uint64_t>(options, dimensions, max_row,
+				max_col);
+	return generate_edges<uint32_t>(options, dimensions, max_row, max_col);
+}
@@ -0,0 +1,41 @@
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include "graph.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <optional>
+#include <string>
+
+enum class GraphModel {
+	// Recursive matrix (Kronecker) model with the Graph500 quadrant
+	// probabilities, which gives a skewed, power-law like degree
+	// distribution.
+	RMAT,
+	// Uniformly random edges, G(n, m).
+	ErdosRenyi
+};
+
+struct GeneratorOptions {
+	GraphModel model = GraphModel::RMAT;
+	// The graph has 2^scale vertices and edge_factor * 2^scale edges.
+	unsigned int scale = 16;
+	size_t edge_factor = 16;
+	uint64_t seed = 1;
+	// R-MAT quadrant probabilities, d is 1 - a - b - c.
+	double a = 0.57, b = 0.19, c = 0.19;
+};
+
+// Parses "<rmat|er>:<scale>[:<edge factor>[:<seed>]]".
+std::optional<GeneratorOptions> parse_generator(const std::string &spec);
+const char *graph_model_name(GraphModel model);
+
+// Generates the graph in parallel. Edges are produced in fixed size chunks
+// that are seeded independently, so the result only depends on the options
+// and not on the number of threads. Duplicate edges and self loops are
+// dropped, so the graph has somewhat fewer than edge_factor * 2^scale edges.
+Graph generate_graph(const GeneratorOptions &options, size_t max_row,
+		size_t max_col);
+
+#endif // GENERATOR_HPP
@@ -1,38 +1,345 @@
 #include "graph.hpp"
 #include "util.hpp"
+#include "profile.hpp"
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <bit>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <parallel/algorithm>
 
-Graph::Graph(const std::string &filepath, size_t max_row, size_t max_col)
-	: _max_row(max_row), _max_col(max_col) {
-	FILE *fp = fopen(filepath.c_str(), "r");
+namespace {
+	// A single edge, for sorting 64-bit ids.
+	struct Tuple {
+		size_t i, j;
+		float weight;
+	};
 
-	char line[256];
-	while(fgets(line, 256, fp)) {
-		if (!line[0] || line[0] == '%' || line[0] == '#')
-			continue;
+	bool col_major_less(const Tuple &a, const Tuple &b) {
+		if (a.j == b.j)
+			return a.i < b.i;
+		return a.j < b.j;
+	}
 
-		size_t row, col;
-		sscanf(line, "%ld %ld", &row, &col);
+	template <typename Id>
+	bool is_col_major(const EdgeArrays<Id> &edges) {
+		for (size_t k = 1; k < edges.size(); k++) {
+			if (edges.dst[k - 1] != edges.dst[k]) {
+				if (edges.dst[k - 1] > edges.dst[k])
+					return false;
+			} else if (edges.src[k - 1] > edges.src[k]) {
+				return false;
+			}
+		}
+		return true;
+	}
 
-		_tuples.emplace_back(row, col, 1);
+	void put_varint(std::vector<uint8_t> &bytes, uint32_t value) {
+		for (; value >= 0x80; value >>= 7)
+			bytes.push_back(static_cast<uint8_t>(value | 0x80));
+		bytes.push_back(static_cast<uint8_t>(value));
 	}
 
-	auto max = std::max_element(_tuples.begin(), _tuples.end(),
-			[] (auto a, auto b) {
-		if (a.i == b.i)
-			return a.j < b.j;
-		return a.i < b.i;
-	});
-	_dimensions = std::max(max->i, max->j) + 1;
-	std::sort(_tuples.begin(), _tuples.end(), [] (auto a, auto b) {
-		if (a.j == b.j)
-			return a.i < b.i;
-		return a.j < b.j;
+	uint32_t get_varint(const uint8_t *&p) {
+		uint32_t value = 0;
+		for (unsigned int shift = 0;; shift += 7) {
+			const auto byte = *p++;
+			value |= uint32_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+	}
+
+	constexpr char TILE_FILE_MAGIC[] = "GRTILES2";
+
+	// Followed by the tile ids, offsets relative to the end of the index,
+	// sizes and the out-degree of every vertex, then by the tiles.
+	struct TileFileHeader {
+		char magic[8];
+		uint64_t dimensions, max_row, max_col;
+		uint64_t num_edges, num_nonempty_subgraphs;
+		uint64_t num_tiles, weighted;
+	};
+
+	template <typename T>
+	bool write_array(FILE *fp, const std::vector<T> &values) {
+		return fwrite(values.data(), sizeof(T), values.size(), fp) ==
+			values.size();
+	}
+
+	template <typename T>
+	bool read_array(FILE *fp, std::vector<T> &values, size_t size) {
+		values.resize(size);
+		return fread(values.data(), sizeof(T), size, fp) == size;
+	}
+
+	// Distinguishes the tile streams in the per-thread read blocks.
+	std::atomic<uint64_t> next_stream_id{1};
+
+	// Edges of a tile in column order, before they are sorted by row.
+	struct TileScratch {
+		std::vector<uint32_t> rows, cols;
+		std::vector<float> weights;
+		std::vector<size_t> offsets;
+	};
+
+	uint64_t morton_key(uint64_t row, uint64_t col) {
+		uint64_t key = 0;
+		for (int bit = 0; bit < 32; bit++) {
+			key |= ((col >> bit) & 1) << (2 * bit + 1);
+			key |= ((row >> bit) & 1) << (2 * bit);
+		}
+		return key;
+	}
+
+	// Distance along the Hilbert curve covering an n x n grid, n being a
+	// power of two.
+	uint64_t hilbert_key(uint64_t n, uint64_t row, uint64_t col) {
+		uint64_t key = 0;
+		for (uint64_t s = n / 2; s > 0; s /= 2) {
+			const uint64_t rx = (col & s) > 0;
+			const uint64_t ry = (row & s) > 0;
+			key += s * s * ((3 * rx) ^ ry);
+			if (ry == 0) {
+				if (rx == 1) {
+					col = s - 1 - col;
+					row = s - 1 - row;
+				}
+				std::swap(col, row);
+			}
+		}
+		return key;
+	}
+}
+
+std::optional<TileOrder> parse_tile_order(const std::string &name) {
+	if (name == "column")
+		return TileOrder::ColumnMajor;
+	if (name == "row")
+		return TileOrder::RowMajor;
+	if (name == "morton")
+		return TileOrder::Morton;
+	if (name == "hilbert")
+		return TileOrder::Hilbert;
+	return std::nullopt;
+}
+
+const char *tile_order_name(TileOrder order) {
+	switch (order) {
+		case TileOrder::ColumnMajor:
+			return "column";
+		case TileOrder::RowMajor:
+			return "row";
+		case TileOrder::Morton:
+			return "morton";
+		case TileOrder::Hilbert:
+			return "hilbert";
+	}
+	return "unknown";
+}
+
+struct Graph::TileStream {
+	TileStream(const std::string &path, const TileFileHeader &header,
+			size_t block_size, bool use_weights)
+	: id(next_stream_id++), block_size(block_size),
+	use_weights(use_weights)
+	{
+		const auto num_tiles = header.num_tiles;
+		data_offset = sizeof(header) + num_tiles * sizeof(uint64_t) +
+			(num_tiles + 1) * sizeof(uint64_t) +
+			num_tiles * sizeof(uint32_t) +
+			header.dimensions * sizeof(uint64_t);
+
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("cannot open tile file " + path);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	TileStream(const TileStream &) = delete;
+	TileStream operator= (const TileStream &) = delete;
+
+	~TileStream() {
+		close(fd);
+	}
+
+	// Reads size bytes at offset into the tiles.
+	void read(uint8_t *out, size_t size, size_t offset) const {
+		while (size) {
+			const auto n = pread(fd, out, size, data_offset + offset);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				throw std::runtime_error("cannot read tile file");
+			out += n;
+			size -= n;
+			offset += n;
+		}
+	}
+
+	// Lets the kernel read the block at offset in the background.
+	void prefetch(size_t offset) const {
+		posix_fadvise(fd, data_offset + offset, block_size,
+				POSIX_FADV_WILLNEED);
+	}
+
+	uint64_t id;
+	int fd = -1;
+	size_t data_offset = 0;
+	size_t block_size;
+	bool use_weights;
+};
+
+Graph::Graph(Graph &&) = default;
+Graph::~Graph() = default;
+Graph &Graph::operator= (Graph &&) = default;
+
+Graph::Graph(size_t dimensions, size_t max_row, size_t max_col)
+	: _max_row(max_row), _max_col(max_col), _dimensions(dimensions),
+	_wide(dimensions > size_t(std::numeric_limits<uint32_t>::max()) + 1)
+{}
+
+Graph::Graph(const std::string &filepath, size_t max_row, size_t max_col,
+		bool weighted)
+	: Graph(0, max_row, max_col) {
+	FILE *fp = fopen(filepath.c_str(), "r");
+
+	profile_phase(Phase::Load, [&] {
+		bool has_weights = false;
+		char line[256];
+		while(fgets(line, 256, fp)) {
+			if (!line[0] || line[0] == '%' || line[0] == '#')
+				continue;
+
+			size_t row, col;
+			float weight = 1;
+			if (sscanf(line, "%ld %ld %f", &row, &col, &weight) < 3 ||
+					!weighted)
+				weight = 1;
+
+			const auto max = std::max(row, col);
+			if (!_wide && max > std::numeric_limits<uint32_t>::max())
+				_widen();
+			_dimensions = std::max(_dimensions, max + 1);
+
+			_visit_edges([&] (auto &edges) {
+				edges.src.push_back(row);
+				edges.dst.push_back(col);
+				// Weights are only kept once one differs from 1.
+				if (weight != 1 && !has_weights) {
+					edges.weights.assign(edges.size() - 1, 1.0f);
+					has_weights = true;
+				}
+				if (has_weights)
+					edges.weights.push_back(weight);
+			});
+		}
+
+		_visit_edges([] (auto &edges) {
+			edges.src.shrink_to_fit();
+			edges.dst.shrink_to_fit();
+			edges.weights.shrink_to_fit();
+		});
 	});
 	fclose(fp);
+
+	_sort_edges();
+}
+
+Graph::Graph(EdgeArrays<uint32_t> edges, size_t dimensions, size_t max_row,
+		size_t max_col)
+	: Graph(dimensions, max_row, max_col) {
+	assert(!_wide);
+	_edges32 = std::move(edges);
+	_sort_edges();
+}
+
+Graph::Graph(EdgeArrays<uint64_t> edges, size_t dimensions, size_t max_row,
+		size_t max_col)
+	: Graph(dimensions, max_row, max_col) {
+	assert(_wide);
+	_edges64 = std::move(edges);
+	_sort_edges();
+}
+
+void Graph::_widen() {
+	_edges64.src.assign(_edges32.src.begin(), _edges32.src.end());
+	_edges64.dst.assign(_edges32.dst.begin(), _edges32.dst.end());
+	_edges64.weights = std::move(_edges32.weights);
+	_edges32 = {};
+	_wide = true;
+}
+
+void Graph::_sort_edges() {
+	ScopedPhase sort(Phase::Sort);
+	_visit_edges([] (auto &edges) {
+		using Id = typename std::remove_cvref_t<
+			decltype(edges.src)>::value_type;
+		if (is_col_major(edges))
+			return;
+
+		const auto n = edges.size();
+		if constexpr (sizeof(Id) == sizeof(uint32_t)) {
+			// Both ids fit one key, which sorts column-major.
+			auto key = [&edges] (size_t k) {
+				return (uint64_t(edges.dst[k]) << 32) | edges.src[k];
+			};
+			auto unpack = [&edges] (size_t k, uint64_t key) {
+				edges.dst[k] = key >> 32;
+				edges.src[k] = key & std::numeric_limits<uint32_t>::max();
+			};
+
+			if (edges.weights.empty()) {
+				std::vector<uint64_t> keys(n);
+				#pragma omp parallel for
+				for (size_t k = 0; k < n; k++)
+					keys[k] = key(k);
+				__gnu_parallel::sort(keys.begin(), keys.end());
+				#pragma omp parallel for
+				for (size_t k = 0; k < n; k++)
+					unpack(k, keys[k]);
+			} else {
+				std::vector<std::pair<uint64_t, float>> keys(n);
+				#pragma omp parallel for
+				for (size_t k = 0; k < n; k++)
+					keys[k] = {key(k), edges.weights[k]};
+				__gnu_parallel::sort(keys.begin(), keys.end(),
+						[] (const auto &a, const auto &b) {
+					return a.first < b.first;
+				});
+				#pragma omp parallel for
+				for (size_t k = 0; k < n; k++) {
+					unpack(k, keys[k].first);
+					edges.weights[k] = keys[k].second;
+				}
+			}
+		} else {
+			std::vector<Tuple> tuples(n);
+			#pragma omp parallel for
+			for (size_t k = 0; k < n; k++)
+				tuples[k] = Tuple{edges.src[k], edges.dst[k],
+					edges.weight(k)};
+			__gnu_parallel::sort(tuples.begin(), tuples.end(),
+					col_major_less);
+			#pragma omp parallel for
+			for (size_t k = 0; k < n; k++) {
+				edges.src[k] = tuples[k].i;
+				edges.dst[k] = tuples[k].j;
+				if (!edges.weights.empty())
+					edges.weights[k] = tuples[k].weight;
+			}
+		}
+	});
 }
 
 size_t Graph::get_dimensions() const {
@@ -51,39 +358,536 @@ size_t Graph::get_subgraph_col(size_t subgraph) const {
 	return subgraph / _max_col;
 }
 
-const std::vector<Tuple> &Graph::get_tuples() const {
-	return _tuples;
+size_t Graph::get_num_edges() const {
+	if (_compressed)
+		return _num_edges;
+	return visit_edges([] (const auto &edges) {
+		return edges.size();
+	});
+}
+
+bool Graph::has_wide_ids() const {
+	return _wide;
+}
+
+size_t Graph::get_edge_bytes() const {
+	if (_compressed) {
+		return (_tiles.ids.capacity() + _tiles.offsets.capacity() +
+				_tiles.first_edge.capacity() +
+				_out_degrees.capacity()) * sizeof(size_t) +
+			_tiles.sizes.capacity() * sizeof(uint32_t) +
+			_tiles.bytes.capacity() +
+			_tiles.weights.capacity() * sizeof(float);
+	}
+	return visit_edges([] (const auto &edges) {
+		return edges.src.capacity() * sizeof(edges.src[0]) +
+			edges.dst.capacity() * sizeof(edges.dst[0]) +
+			edges.weights.capacity() * sizeof(float);
+	});
+}
+
+size_t Graph::get_num_nonempty_subgraphs() const {
+	if (_compressed)
+		return _num_nonempty_subgraphs;
+
+	const auto num_cols = round_up(_dimensions, _max_col) / _max_col;
+	const auto num_rows = round_up(_dimensions, _max_row) / _max_row;
+
+	size_t count = 0;
+	#pragma omp parallel reduction(+:count)
+	{
+		// Remembers the last column strip a row block was seen in, so
+		// the marks never need to be cleared.
+		std::vector<size_t> seen(num_rows,
+				std::numeric_limits<size_t>::max());
+
+		#pragma omp for schedule(dynamic, 16)
+		for (size_t col = 0; col < num_cols; col++) {
+			auto [lower_col, upper_col] = _column_range(col);
+			visit_edges([&] (const auto &edges) {
+				for (auto k = lower_col; k != upper_col; k++) {
+					const auto row = edges.src[k] / _max_row;
+					if (seen[row] != col) {
+						seen[row] = col;
+						count++;
+					}
+				}
+			});
+		}
+	}
+	return count;
+}
+
+std::vector<size_t> Graph::get_subgraph_sizes() const {
+	const auto num_subgraphs = get_num_subgraphs();
+	std::vector<size_t> sizes(num_subgraphs);
+
+	if (_compressed) {
+		for (size_t t = 0; t < _tiles.ids.size(); t++)
+			sizes[_tiles.ids[t]] = _tiles.sizes[t];
+		return sizes;
+	}
+
+	const auto num_cols = round_up(num_subgraphs, _max_col) / _max_col;
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (size_t col = 0; col < num_cols; col++) {
+		auto [lower_col, upper_col] = _column_range(col);
+		visit_edges([&] (const auto &edges) {
+			for (auto k = lower_col; k != upper_col; k++) {
+				// Same mapping as get_subgraph_row and
+				// get_subgraph_col.
+				const auto row = edges.src[k] / _max_row;
+				const auto subgraph = col * _max_col + row;
+				if (row < _max_col && subgraph < num_subgraphs)
+					sizes[subgraph]++;
+			}
+		});
+	}
+	return sizes;
+}
+
+std::vector<size_t> Graph::get_subgraph_order(TileOrder order) const {
+	const auto num_subgraphs = get_num_subgraphs();
+	std::vector<size_t> indices(num_subgraphs);
+	std::iota(indices.begin(), indices.end(), 0);
+	if (order == TileOrder::ColumnMajor)
+		return indices;
+
+	const auto grid_size = std::bit_ceil(std::max(
+			std::min(num_subgraphs, _max_col),
+			get_subgraph_col(num_subgraphs - 1) + 1));
+
+	std::vector<uint64_t> keys(num_subgraphs);
+	#pragma omp parallel for
+	for (size_t k = 0; k < num_subgraphs; k++) {
+		const auto row = get_subgraph_row(k);
+		const auto col = get_subgraph_col(k);
+		switch (order) {
+			case TileOrder::RowMajor:
+				keys[k] = row * grid_size + col;
+				break;
+			case TileOrder::Morton:
+				keys[k] = morton_key(row, col);
+				break;
+			case TileOrder::Hilbert:
+				keys[k] = hilbert_key(grid_size, row, col);
+				break;
+			default:
+				assert(!"What");
+		}
+	}
+
+	__gnu_parallel::sort(indices.begin(), indices.end(),
+			[&keys] (size_t a, size_t b) {
+		if (keys[a] == keys[b])
+			return a < b;
+		return keys[a] < keys[b];
+	});
+	return indices;
+}
+
+Graph Graph::transposed() const {
+	Graph result(_dimensions, _max_row, _max_col);
+	result._edges32 = {_edges32.dst, _edges32.src, _edges32.weights};
+	result._edges64 = {_edges64.dst, _edges64.src, _edges64.weights};
+	result._sort_edges();
+	return result;
+}
+
+void Graph::relabel(const std::vector<size_t> &new_id) {
+	assert(new_id.size() == _dimensions);
+
+	_visit_edges([&new_id] (auto &edges) {
+		#pragma omp parallel for
+		for (size_t k = 0; k < edges.size(); k++) {
+			edges.src[k] = new_id[edges.src[k]];
+			edges.dst[k] = new_id[edges.dst[k]];
+		}
+	});
+	_sort_edges();
+}
+
+std::pair<size_t, size_t> Graph::_column_range(size_t col) const {
+	return visit_edges([this, col] (const auto &edges) {
+		const auto begin = edges.dst.begin();
+		const auto lower_col = std::lower_bound(begin, edges.dst.end(),
+				col * _max_col);
+		const auto upper_col = std::upper_bound(begin, edges.dst.end(),
+				(col + 1) * _max_col - 1);
+		return std::make_pair<size_t, size_t>(lower_col - begin,
+				upper_col - begin);
+	});
 }
 
 SubGraph Graph::get_subgraph_at(size_t subgraph) const {
+	SubGraph result;
+	get_subgraph_at(subgraph, result);
+	return result;
+}
+
+void Graph::get_subgraph_at(size_t subgraph, SubGraph &out) const {
 	const auto row = get_subgraph_row(subgraph);
 	const auto col = get_subgraph_col(subgraph);
 
-	auto col_comp = [] (auto a, auto b) -> bool {
-		return a.j < b.j;
-	};
+	// Only the tile's row block of the column strip needs sorting.
+	const auto lower_row = row * _max_row;
+	const auto upper_row = (row + 1) * _max_row;
 
-	auto lower_col = std::lower_bound(_tuples.begin(), _tuples.end(),
-			Tuple{0, col * _max_col, 0}, col_comp);
-	auto upper_col = std::upper_bound(_tuples.begin(), _tuples.end(),
-			Tuple{0, (col + 1) * _max_col - 1, 0}, col_comp);
+	out.dimensions = _max_row;
+	out.row_offset = lower_row;
+	out.col_offset = col * _max_col;
+	out.row_scale = {};
+	out.row_scale_base = 0;
+	out.rows.clear();
+	out.cols.clear();
+	out.weights.clear();
 
-	std::vector<Tuple> temp(lower_col, upper_col);
-	std::sort(temp.begin(), temp.end(), [] (auto a, auto b) {
-		if (a.i == b.i)
-			return a.j < b.j;
-		return a.i < b.i;
+	if (_compressed) {
+		_decode_tile(subgraph, out);
+		return;
+	}
+
+	auto [lower_col, upper_col] = _column_range(col);
+	visit_edges([&] (const auto &edges) {
+		const bool weighted = !edges.weights.empty();
+
+		thread_local TileScratch scratch;
+		scratch.rows.clear();
+		scratch.cols.clear();
+		scratch.weights.clear();
+		for (auto k = lower_col; k != upper_col; k++) {
+			const auto i = edges.src[k];
+			if (i < lower_row || i >= upper_row)
+				continue;
+			scratch.rows.push_back(i - lower_row);
+			scratch.cols.push_back(edges.dst[k] - out.col_offset);
+			if (weighted)
+				scratch.weights.push_back(edges.weights[k]);
+		}
+
+		// The strip is sorted by column, so a stable counting sort by
+		// row leaves the tile in row-major order.
+		const auto n = scratch.rows.size();
+		scratch.offsets.assign(_max_row + 1, 0);
+		for (auto row : scratch.rows)
+			scratch.offsets[row + 1]++;
+		std::inclusive_scan(scratch.offsets.begin(), scratch.offsets.end(),
+				scratch.offsets.begin());
+
+		out.rows.resize(n);
+		out.cols.resize(n);
+		if (weighted)
+			out.weights.resize(n);
+		for (size_t k = 0; k < n; k++) {
+			const auto pos = scratch.offsets[scratch.rows[k]]++;
+			out.rows[pos] = scratch.rows[k];
+			out.cols[pos] = scratch.cols[k];
+			if (weighted)
+				out.weights[pos] = scratch.weights[k];
+		}
 	});
+}
+
+void Graph::_decode_tile(size_t subgraph, SubGraph &out) const {
+	const auto it = std::lower_bound(_tiles.ids.begin(), _tiles.ids.end(),
+			subgraph);
+	if (it == _tiles.ids.end() || *it != subgraph)
+		return;
+
+	const auto t = it - _tiles.ids.begin();
+	const auto n = _tiles.sizes[t];
+	const auto *p = _read_tile(t);
+	out.rows.resize(n);
+	out.cols.resize(n);
+
+	uint32_t row = 0, col = 0;
+	for (size_t k = 0; k < n; k++) {
+		const auto row_delta = get_varint(p);
+		row += row_delta;
+		if (!k || row_delta)
+			col = get_varint(p);
+		else
+			col += get_varint(p) + 1;
+		out.rows[k] = row;
+		out.cols[k] = col;
+	}
+
+	if (_stream) {
+		if (_stream->use_weights) {
+			out.weights.resize(n);
+			memcpy(out.weights.data(), p, n * sizeof(float));
+		}
+	} else if (!_tiles.weights.empty()) {
+		const auto first = _tiles.weights.begin() + _tiles.first_edge[t];
+		out.weights.assign(first, first + n);
+	}
+}
+
+const uint8_t *Graph::_read_tile(size_t t) const {
+	if (!_stream)
+		return &_tiles.bytes[_tiles.offsets[t]];
+
+	// Last block this thread read, from any streamed graph.
+	thread_local struct {
+		uint64_t stream = 0;
+		size_t begin = 0, end = 0;
+		std::vector<uint8_t> bytes;
+	} block;
+
+	const auto begin = _tiles.offsets[t];
+	const auto end = _tiles.offsets[t + 1];
+	if (block.stream != _stream->id || begin < block.begin ||
+			end > block.end) {
+		const auto size = std::max(end - begin, std::min(
+					_stream->block_size, _tiles.offsets.back() - begin));
+		block.bytes.resize(size);
+		block.stream = _stream->id;
+		block.begin = begin;
+		block.end = begin + size;
+		_stream->read(block.bytes.data(), size, begin);
+		_stream->prefetch(block.end);
+	}
+	return &block.bytes[begin - block.begin];
+}
+
+bool Graph::is_compressed() const {
+	return _compressed;
+}
+
+bool Graph::is_streamed() const {
+	return static_cast<bool>(_stream);
+}
+
+void Graph::compress_tiles() {
+	if (_compressed)
+		return;
 
-	auto row_comp = [] (auto a, auto b) -> bool {
-		return a.i < b.i;
+	// Tiles of one column strip, encoded independently of the others.
+	struct Strip {
+		std::vector<size_t> ids, num_bytes;
+		std::vector<uint32_t> sizes;
+		std::vector<uint8_t> bytes;
+		std::vector<float> weights;
 	};
 
-	auto lower_row = std::lower_bound(temp.begin(), temp.end(),
-			Tuple{row * _max_row, 0, 0}, row_comp);
-	auto upper_row = std::upper_bound(temp.begin(), temp.end(),
-			Tuple{(row + 1) * _max_row - 1, 0, 0}, row_comp);
+	const auto num_subgraphs = get_num_subgraphs();
+	const auto num_cols = round_up(num_subgraphs, _max_col) / _max_col;
+	std::vector<Strip> strips(num_cols);
+
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (size_t col = 0; col < num_cols; col++) {
+		auto [lower_col, upper_col] = _column_range(col);
+		auto &strip = strips[col];
+		visit_edges([&] (const auto &edges) {
+			// The strip is sorted by column, so a stable sort by source
+			// makes every tile row-major.
+			std::vector<size_t> order(upper_col - lower_col);
+			std::iota(order.begin(), order.end(), lower_col);
+			std::stable_sort(order.begin(), order.end(),
+					[&edges] (size_t a, size_t b) {
+				return edges.src[a] < edges.src[b];
+			});
+
+			for (size_t k = 0; k < order.size();) {
+				const auto row = edges.src[order[k]] / _max_row;
+				auto end = k;
+				while (end < order.size() &&
+						edges.src[order[end]] / _max_row == row)
+					end++;
+
+				// Same mapping as get_subgraph_sizes, other tiles can
+				// never be asked for.
+				const auto subgraph = col * _max_col + row;
+				if (row >= _max_col || subgraph >= num_subgraphs) {
+					k = end;
+					continue;
+				}
+
+				const auto start = strip.bytes.size();
+				strip.ids.push_back(subgraph);
+				strip.sizes.push_back(end - k);
+
+				uint32_t last_row = 0, last_col = 0;
+				for (auto first = k; k < end; k++) {
+					const uint32_t i = edges.src[order[k]] - row * _max_row;
+					const uint32_t j = edges.dst[order[k]] - col * _max_col;
+					put_varint(strip.bytes, i - last_row);
+					if (k == first || i != last_row)
+						put_varint(strip.bytes, j);
+					else
+						put_varint(strip.bytes, j - last_col - 1);
+					last_row = i;
+					last_col = j;
+					if (!edges.weights.empty())
+						strip.weights.push_back(edges.weights[order[k]]);
+				}
+				strip.num_bytes.push_back(strip.bytes.size() - start);
+			}
+		});
+	}
+
+	_num_edges = get_num_edges();
+	_num_nonempty_subgraphs = get_num_nonempty_subgraphs();
+	_out_degrees = get_out_degrees();
+	const bool weighted = visit_edges([] (const auto &edges) {
+		return !edges.weights.empty();
+	});
+	_edges32 = {};
+	_edges64 = {};
+
+	// Where every strip starts in the concatenated index.
+	std::vector<size_t> first_tile(num_cols + 1), first_byte(num_cols + 1),
+		first_weight(num_cols + 1);
+	for (size_t col = 0; col < num_cols; col++) {
+		first_tile[col + 1] = first_tile[col] + strips[col].ids.size();
+		first_byte[col + 1] = first_byte[col] + strips[col].bytes.size();
+		first_weight[col + 1] = first_weight[col] +
+			strips[col].weights.size();
+	}
+
+	const auto num_tiles = first_tile[num_cols];
+	_tiles.ids.resize(num_tiles);
+	_tiles.offsets.resize(num_tiles + 1);
+	_tiles.offsets[num_tiles] = first_byte[num_cols];
+	_tiles.sizes.resize(num_tiles);
+	_tiles.bytes.resize(first_byte[num_cols]);
+	if (weighted) {
+		_tiles.first_edge.resize(num_tiles);
+		_tiles.weights.resize(first_weight[num_cols]);
+	}
+
+	#pragma omp parallel for schedule(dynamic, 16)
+	for (size_t col = 0; col < num_cols; col++) {
+		auto &strip = strips[col];
+		auto offset = first_byte[col], edge = first_weight[col];
+		for (size_t t = 0; t < strip.ids.size(); t++) {
+			const auto tile = first_tile[col] + t;
+			_tiles.ids[tile] = strip.ids[t];
+			_tiles.offsets[tile] = offset;
+			_tiles.sizes[tile] = strip.sizes[t];
+			offset += strip.num_bytes[t];
+			if (weighted) {
+				_tiles.first_edge[tile] = edge;
+				edge += strip.sizes[t];
+			}
+		}
+		std::copy(strip.bytes.begin(), strip.bytes.end(),
+				_tiles.bytes.begin() + first_byte[col]);
+		std::copy(strip.weights.begin(), strip.weights.end(),
+				_tiles.weights.begin() + first_weight[col]);
+		strip = {};
+	}
+	_compressed = true;
+}
+
+void Graph::stream_tiles(const std::string &path, size_t block_size,
+		bool use_weights) {
+	if (_stream)
+		return;
+	compress_tiles();
+
+	const auto num_tiles = _tiles.ids.size();
+	const bool weighted = !_tiles.weights.empty();
+
+	// The weights of a tile follow its edges.
+	std::vector<size_t> offsets(num_tiles + 1);
+	for (size_t t = 0; t < num_tiles; t++) {
+		offsets[t + 1] = offsets[t] + _tiles.offsets[t + 1] -
+			_tiles.offsets[t];
+		if (weighted)
+			offsets[t + 1] += _tiles.sizes[t] * sizeof(float);
+	}
 
-	return SubGraph{_max_row, row * _max_row, col * _max_col,
-		std::vector<Tuple>(lower_row, upper_row)};
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (!fp)
+		throw std::runtime_error("cannot create tile file " + path);
+
+	TileFileHeader header;
+	memcpy(header.magic, TILE_FILE_MAGIC, sizeof(header.magic));
+	header.dimensions = _dimensions;
+	header.max_row = _max_row;
+	header.max_col = _max_col;
+	header.num_edges = _num_edges;
+	header.num_nonempty_subgraphs = _num_nonempty_subgraphs;
+	header.num_tiles = num_tiles;
+	header.weighted = weighted;
+
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		write_array(fp, _tiles.ids) && write_array(fp, offsets) &&
+		write_array(fp, _tiles.sizes) && write_array(fp, _out_degrees);
+	for (size_t t = 0; ok && t < num_tiles; t++) {
+		const auto begin = _tiles.offsets[t];
+		const auto size = _tiles.offsets[t + 1] - begin;
+		ok = fwrite(&_tiles.bytes[begin], 1, size, fp) == size;
+		if (ok && weighted) {
+			ok = fwrite(&_tiles.weights[_tiles.first_edge[t]],
+					sizeof(float), _tiles.sizes[t], fp) ==
+				_tiles.sizes[t];
+		}
+	}
+	if (fclose(fp) || !ok)
+		throw std::runtime_error("cannot write tile file " + path);
+
+	_tiles.offsets = std::move(offsets);
+	_tiles.bytes = std::vector<uint8_t>();
+	_tiles.first_edge = std::vector<size_t>();
+	_tiles.weights = std::vector<float>();
+	_stream = std::make_unique<TileStream>(path, header, block_size,
+			weighted && use_weights);
+}
+
+Graph Graph::open_tiles(const std::string &path, size_t block_size,
+		bool weighted) {
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		throw std::runtime_error("cannot open tile file " + path);
+
+	TileFileHeader header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+			memcmp(header.magic, TILE_FILE_MAGIC, sizeof(header.magic))) {
+		fclose(fp);
+		throw std::runtime_error(path + " is not a tile file");
+	}
+
+	Graph graph(header.dimensions, header.max_row, header.max_col);
+	graph._compressed = true;
+	graph._num_edges = header.num_edges;
+	graph._num_nonempty_subgraphs = header.num_nonempty_subgraphs;
+
+	auto &tiles = graph._tiles;
+	const bool ok = read_array(fp, tiles.ids, header.num_tiles) &&
+		read_array(fp, tiles.offsets, header.num_tiles + 1) &&
+		read_array(fp, tiles.sizes, header.num_tiles) &&
+		read_array(fp, graph._out_degrees, header.dimensions);
+	fclose(fp);
+	if (!ok)
+		throw std::runtime_error("truncated tile file " + path);
+
+	graph._stream = std::make_unique<TileStream>(path, header, block_size,
+			weighted && header.weighted);
+	return graph;
+}
+
+bool Graph::is_tile_file(const std::string &path) {
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		return false;
+
+	char magic[sizeof(TILE_FILE_MAGIC) - 1];
+	const bool match = fread(magic, sizeof(magic), 1, fp) == 1 &&
+		!memcmp(magic, TILE_FILE_MAGIC, sizeof(magic));
+	fclose(fp);
+	return match;
+}
+
+std::vector<size_t> Graph::get_out_degrees() const {
+	if (_compressed)
+		return _out_degrees;
+
+	std::vector<size_t> degrees(_dimensions);
+	visit_edges([&degrees] (const auto &edges) {
+		for (auto i : edges.src)
+			degrees[i]++;
+	});
+	return degrees;
 }
@@ -2,40 +2,226 @@
 #define GRAPH_HPP
 
 #include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <utility>
 #include <vector>
 
-struct Tuple {
-	size_t i, j;
-	float weight;
+// Edges as a structure of arrays, with vertex ids of type Id.
+template <typename Id>
+struct EdgeArrays {
+	std::vector<Id> src, dst;
+	// Empty if every edge weighs 1.
+	std::vector<float> weights;
+
+	size_t size() const {
+		return src.size();
+	}
+
+	float weight(size_t k) const {
+		return weights.empty() ? 1.0f : weights[k];
+	}
 };
 
 struct SubGraph {
 	size_t dimensions;
 	size_t row_offset, col_offset;
-	std::vector<Tuple> tuples;
+	// Edges in row-major order, as row and column within the tile.
+	std::vector<uint32_t> rows, cols;
+	// Empty if every edge weighs 1.
+	std::vector<float> weights;
+	// Optional scale for every source vertex, indexed by global row minus
+	// row_scale_base. It is applied when the tile is written, so the edges
+	// are never modified.
+	std::span<const float> row_scale;
+	size_t row_scale_base = 0;
+
+	size_t size() const {
+		return rows.size();
+	}
+
+	bool empty() const {
+		return rows.empty();
+	}
+
+	// Global source and destination of edge k.
+	size_t row(size_t k) const {
+		return row_offset + rows[k];
+	}
+
+	size_t col(size_t k) const {
+		return col_offset + cols[k];
+	}
+
+	float weight(size_t k) const {
+		const auto weight = weights.empty() ? 1.0f : weights[k];
+		if (row_scale.empty())
+			return weight;
+		return weight * row_scale[row(k) - row_scale_base];
+	}
 };
 
+// Order in which the tile grid is traversed. Each thread processes a
+// contiguous chunk of the traversal, so the order also decides which vertex
+// slices a thread touches.
+enum class TileOrder {
+	// Column blocks outer, row blocks inner. This is the subgraph index
+	// order.
+	ColumnMajor,
+	// Row blocks outer, column blocks inner.
+	RowMajor,
+	Morton,
+	Hilbert
+};
+
+std::optional<TileOrder> parse_tile_order(const std::string &name);
+const char *tile_order_name(TileOrder order);
+
 class Graph {
 public:
-	Graph(const std::string &filepath, size_t max_row, size_t max_col);
+	// Reads "<src> <dest> [weight]" lines. Unless weighted, or if the
+	// weight is missing, every edge weighs 1.
+	Graph(const std::string &filepath, size_t max_row, size_t max_col,
+			bool weighted = false);
+	// Takes ownership of the edges, e.g. from a generator. All vertex ids
+	// must be below dimensions, and they are 64 bits wide exactly if they
+	// do not fit 32 bits.
+	Graph(EdgeArrays<uint32_t> edges, size_t dimensions, size_t max_row,
+			size_t max_col);
+	Graph(EdgeArrays<uint64_t> edges, size_t dimensions, size_t max_row,
+			size_t max_col);
 
 	Graph(const Graph &) = delete;
-	Graph(Graph &&) = default;
+	Graph(Graph &&);
+	~Graph();
 
 	Graph operator= (const Graph &) = delete;
-	Graph &operator= (Graph &&) = default;
+	Graph &operator= (Graph &&);
+
+	// Opens a file written by stream_tiles, see there. Weights in the
+	// file are dropped unless weighted.
+	static Graph open_tiles(const std::string &path, size_t block_size,
+			bool weighted = false);
+	// Whether path starts like a file written by stream_tiles.
+	static bool is_tile_file(const std::string &path);
 
 	size_t get_dimensions() const;
 	size_t get_num_subgraphs() const;
 	size_t get_subgraph_row(size_t subgraph) const;
 	size_t get_subgraph_col(size_t subgraph) const;
 	SubGraph get_subgraph_at(size_t subgraph) const;
-	const std::vector<Tuple> &get_tuples() const;
+	// Same as above, but reuses the memory already owned by out.
+	void get_subgraph_at(size_t subgraph, SubGraph &out) const;
+	// Permutation of all subgraph indices in the given traversal order.
+	std::vector<size_t> get_subgraph_order(TileOrder order) const;
+
+	size_t get_num_edges() const;
+	// Vertex ids are 32 bits wide unless the graph has more vertices.
+	bool has_wide_ids() const;
+	// Memory held by the edges, or by the tiles once compressed.
+	size_t get_edge_bytes() const;
+
+	// Replaces the edges by a compressed copy of every tile, which
+	// get_subgraph_at decodes. Afterwards the edges can no longer be
+	// visited, so the graph cannot be transposed or relabeled either.
+	void compress_tiles();
+	bool is_compressed() const;
+
+	// Compresses the tiles and moves them to a file at path, so only
+	// their index stays in memory. The file keeps the weights, but
+	// get_subgraph_at only returns them if use_weights. It reads the file
+	// in blocks of block_size bytes per thread, starting at the
+	// requested tile, and asks the kernel to fetch the following block
+	// in the background. Tiles are stored in subgraph index order, so a
+	// column-major traversal reads every thread's range sequentially.
+	void stream_tiles(const std::string &path, size_t block_size,
+			bool use_weights = true);
+	bool is_streamed() const;
+
+	// Number of edges leaving every vertex, including those in tiles that
+	// get_subgraph_at never returns. Compressed graphs keep the degrees
+	// from before they dropped those edges.
+	std::vector<size_t> get_out_degrees() const;
+
+	// Calls f(const EdgeArrays<Id> &) on the edges, sorted column-major,
+	// and returns its result.
+	template <typename F>
+	decltype(auto) visit_edges(F f) const {
+		assert(!_compressed);
+		if (_wide)
+			return f(_edges64);
+		return f(_edges32);
+	}
+
+	// Number of edges in every subgraph, indexed like get_subgraph_at.
+	std::vector<size_t> get_subgraph_sizes() const;
+
+	// Number of tiles in the full tile grid that contain at least one edge.
+	size_t get_num_nonempty_subgraphs() const;
+
+	// Same graph with every edge reversed.
+	Graph transposed() const;
+
+	// Renumbers every vertex v to new_id[v] and restores the column-major
+	// edge order.
+	void relabel(const std::vector<size_t> &new_id);
 private:
+	Graph(size_t dimensions, size_t max_row, size_t max_col);
+
+	template <typename F>
+	decltype(auto) _visit_edges(F f) {
+		if (_wide)
+			return f(_edges64);
+		return f(_edges32);
+	}
+
+	// Switches to 64-bit vertex ids.
+	void _widen();
+	void _sort_edges();
+	// Range of edge indices in column strip col.
+	std::pair<size_t, size_t> _column_range(size_t col) const;
+	void _decode_tile(size_t subgraph, SubGraph &out) const;
+	// Encoded tile t, read from the file if streamed.
+	const uint8_t *_read_tile(size_t t) const;
+
+	// Every non-empty tile as the local row and column of each edge in
+	// row-major order. Rows are stored as the difference to the previous
+	// edge, and so are columns within a row, all as varints. With
+	// crossbars up to 128 wide an edge mostly takes two bytes.
+	struct TileIndex {
+		// Subgraph index of every tile, ascending.
+		std::vector<size_t> ids;
+		// Start of every tile in bytes, plus the end.
+		std::vector<size_t> offsets;
+		// Number of edges in every tile.
+		std::vector<uint32_t> sizes;
+		std::vector<uint8_t> bytes;
+		// Index of the first weight of every tile. Both are empty if
+		// every edge weighs 1. Streamed tiles store their weights right
+		// after their edges instead.
+		std::vector<size_t> first_edge;
+		std::vector<float> weights;
+	};
+
+	// Open tile file, see stream_tiles.
+	struct TileStream;
+
 	size_t _max_row, _max_col;
 	size_t _dimensions;
-	std::vector<Tuple> _tuples;
+	bool _wide = false;
+	EdgeArrays<uint32_t> _edges32;
+	EdgeArrays<uint64_t> _edges64;
+
+	bool _compressed = false;
+	// Kept from the edges, which are gone once compressed.
+	size_t _num_edges = 0, _num_nonempty_subgraphs = 0;
+	std::vector<size_t> _out_degrees;
+	TileIndex _tiles;
+	std::unique_ptr<TileStream> _stream;
 };
 
 #endif // GRAPH_HPP
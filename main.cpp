@@ -3,9 +3,21 @@
 #include <optional>
 #include <functional>
 #include <cmath>
+#include <atomic>
+#include <span>
+#include <tuple>
+#include <charconv>
+#include <string_view>
+#include <getopt.h>
 #include "experiment.hpp"
 #include "util.hpp"
+#include "frontier.hpp"
 #include "graph.hpp"
+#include "reorder.hpp"
+#include "generator.hpp"
+#include "profile.hpp"
+#include "numa.hpp"
+#include "tile_cost.hpp"
 
 namespace {
 
@@ -21,6 +33,326 @@ namespace {
 	constexpr float STATIC_LATENCY = 0.5e-9;
 	constexpr float DYNAMIC_LATENCY = 1.1e-9;
 	constexpr float DYNAMIC_ENERGY = 28.8e-12;
+
+	// Direction switching thresholds from Beamer et al.
+	constexpr size_t BFS_ALPHA = 14;
+	constexpr size_t BFS_BETA = 24;
+
+	CrossbarOptions graphr_options(float cols_per_adc, int datatype_size,
+			int input_size, bool packed) {
+		CrossbarOptions options;
+		options.num_rows = 128;
+		options.num_cols = 128;
+		options.cols_per_adc = cols_per_adc;
+		options.datatype_size = datatype_size;
+		options.input_size = input_size;
+		options.read_device = ADC;
+		options.read_latency = READ_TIME;
+		options.read_energy = READ_ENERGY;
+		options.write_latency = WRITE_TIME;
+		options.write_energy = WRITE_ENERGY;
+		options.adc_latency = ADC_LATENCY;
+		options.adc_energy = ADC_ENERGY;
+		options.sa_latency = SA_LATENCY;
+		options.sa_energy = SA_ENERGY;
+		options.static_energy = STATIC_ENERGY;
+		options.static_latency = STATIC_LATENCY;
+		options.dynamic_energy = 0;
+		options.dynamic_latency = 0;
+		options.packed = packed;
+		return options;
+	}
+
+	CrossbarOptions sparse_mem_options(int datatype_size, bool packed) {
+		CrossbarOptions options;
+		options.num_rows = 128;
+		options.num_cols = 128;
+		options.cols_per_adc = 0.25;
+		options.datatype_size = datatype_size;
+		options.input_size = 0;
+		options.read_device = SA;
+		options.read_latency = READ_TIME;
+		options.read_energy = READ_ENERGY;
+		options.write_latency = WRITE_TIME;
+		options.write_energy = WRITE_ENERGY;
+		options.adc_latency = ADC_LATENCY;
+		options.adc_energy = ADC_ENERGY;
+		options.sa_latency = SA_LATENCY;
+		options.sa_energy = SA_ENERGY;
+		options.static_energy = 0;
+		options.static_latency = 0;
+		options.dynamic_energy = DYNAMIC_ENERGY;
+		options.dynamic_latency = DYNAMIC_LATENCY;
+		options.packed = packed;
+		return options;
+	}
+
+	struct Options {
+		const char *graph_path = nullptr;
+		// Used instead of graph_path when set.
+		std::optional<GeneratorOptions> generator;
+		Ordering ordering = Ordering::None;
+		TileOrder tile_order = TileOrder::ColumnMajor;
+		size_t pipeline_depth = 0;
+		double pagerank_delta = 0;
+		bool gauss_seidel = false;
+		// Simulate SparseMEM alongside Graphr on the same tile stream.
+		bool fused = false;
+		// Switch BFS between top-down and bottom-up steps.
+		bool direction_optimizing = false;
+		// Fraction of tiles simulated per iteration, 0 simulates all.
+		double sample_rate = 0;
+		// Bucket width of delta-stepping SSSP, 0 disables it.
+		unsigned int delta = 0;
+		// Threads own column strips and share a single copy of the data.
+		bool owner_computes = false;
+		// Keep the graph as compressed tiles once it is set up.
+		bool compress_tiles = false;
+		// Move the compressed tiles to this file and stream them from
+		// there, reading at most stream_budget bytes at once.
+		std::string stream_path;
+		size_t stream_budget = size_t(256) << 20;
+		Pinning pinning = Pinning::None;
+		// Run the tiles in this many forked processes instead of
+		// threads, 0 or 1 keeps the threads.
+		size_t processes = 0;
+		// Store crossbar cells as codes of datatype_size bits.
+		bool quantize = false;
+		// Only print the Stats of a pass over all tiles, from tile
+		// costs cached in this directory.
+		std::string cost_cache;
+		// Batched BFS/SSSP sources, in original vertex ids.
+		std::vector<size_t> sources;
+	};
+
+	template <typename Experiment>
+	void print_traversal_time(const Options &opts,
+			const Experiment &experiment) {
+		std::cout << "Tile traversal (" << tile_order_name(opts.tile_order)
+			<< "): " << experiment.get_traversal_time() << "s"
+			<< std::endl;
+		if (!Profiler::get().is_enabled())
+			return;
+
+		const auto usage = experiment.get_arena_usage();
+		std::cout << "Tile scratch: " << usage.allocations
+			<< " allocations, " << usage.heap_allocations
+			<< " from the heap, peak " << usage.peak_bytes
+			<< " bytes per tile, " << usage.capacity << " bytes reserved"
+			<< std::endl;
+	}
+
+	// Every kernel thread and its pipeline thread read their own block.
+	size_t stream_block_size(const Options &opts) {
+		return std::max<size_t>(opts.stream_budget /
+				(2 * omp_get_max_threads()), 4096);
+	}
+
+	// Compresses or streams the tiles as asked for. The edges are gone
+	// afterwards, so this has to come after everything that reads them.
+	void store_tiles(const Options &opts, Graph &graph, bool weighted,
+			const std::string &suffix = "") {
+		if (graph.is_streamed())
+			return;
+
+		const auto bytes = graph.get_edge_bytes();
+		if (!opts.stream_path.empty()) {
+			const auto path = opts.stream_path + suffix;
+			graph.stream_tiles(path, stream_block_size(opts), weighted);
+			std::cout << "Streaming tiles from " << path << ": " << bytes
+				<< " -> " << graph.get_edge_bytes() << " bytes in memory"
+				<< std::endl;
+		} else if (opts.compress_tiles && !graph.is_compressed()) {
+			graph.compress_tiles();
+			std::cout << "Compressed tiles: " << bytes << " -> "
+				<< graph.get_edge_bytes() << " bytes" << std::endl;
+		}
+	}
+
+	template <typename Experiment>
+	void configure_experiment(const Options &opts, Experiment &experiment,
+			std::shared_ptr<Graph> graph) {
+		experiment.set_tile_order(opts.tile_order);
+		experiment.set_pipeline_depth(opts.pipeline_depth);
+		experiment.set_sampling(opts.sample_rate);
+		experiment.set_owner_computes(opts.owner_computes);
+		experiment.set_processes(opts.processes);
+		experiment.set_graph(graph);
+	}
+
+	// With owner computes, the distance of a vertex may be read as a row
+	// input by any thread while the owner of its column updates it.
+	inline short load_distance(short &d) {
+		return std::atomic_ref<short>(d).load(std::memory_order_relaxed);
+	}
+
+	inline void store_distance(short &d, short value) {
+		std::atomic_ref<short>(d).store(value, std::memory_order_relaxed);
+	}
+
+	// Only the first store takes the line exclusively, the copies of
+	// other threads may share it.
+	inline void set_active(bool &is_active) {
+		std::atomic_ref<bool> active(is_active);
+		if (!active.load(std::memory_order_relaxed))
+			active.store(true, std::memory_order_relaxed);
+	}
+
+	template <typename Experiment>
+	void print_estimate(const Options &opts, const Experiment &experiment) {
+		if (opts.sample_rate <= 0)
+			return;
+
+		std::cout << "Estimated from " << experiment.get_num_sampled_tiles()
+			<< " of " << experiment.get_num_estimated_tiles()
+			<< " tiles (95% confidence intervals):" << std::endl;
+		experiment.get_estimate().print();
+	}
+
+	// Sums the SparseMEM Stats of a fused experiment over all threads.
+	template <typename Experiment>
+	Stats get_secondary_stats(const Experiment &experiment) {
+		Stats stats;
+		for (auto &approach : experiment.get_approaches())
+			stats += approach.get_secondary_stats();
+		return stats;
+	}
+
+	void print_stats(const Stats &graphr_stats,
+			const Stats &sparse_mem_stats) {
+		std::cout << "Graphr stats: " << std::endl;
+		graphr_stats.print();
+
+		std::cout << "SparseMEM stats: " << std::endl;
+		sparse_mem_stats.print();
+	}
+
+	// Parses the whole of value as a T, nullopt if it is something else
+	// or does not fit. Unsigned types take no sign.
+	template <typename T>
+	std::optional<T> parse_number(std::string_view value) {
+		T number;
+		const auto end = value.data() + value.size();
+		const auto [ptr, error] = std::from_chars(value.data(), end, number);
+		if (error != std::errc() || ptr != end)
+			return std::nullopt;
+		return number;
+	}
+
+	// Identifies the graph before it is loaded. A generated graph only
+	// depends on its options.
+	uint64_t graph_hash(const Options &options) {
+		if (!options.generator)
+			return hash_file(options.graph_path);
+
+		const auto &generator = *options.generator;
+		return hash_string(std::string(graph_model_name(generator.model)) +
+				":" + std::to_string(generator.scale) + ":" +
+				std::to_string(generator.edge_factor) + ":" +
+				std::to_string(generator.seed) + ":" +
+				std::to_string(generator.a) + ":" +
+				std::to_string(generator.b) + ":" +
+				std::to_string(generator.c));
+	}
+
+	// Generated graphs are always unweighted. A streamed graph keeps its
+	// weights in the tile file in any case, so the file can be used for
+	// all algorithms.
+	std::tuple<std::shared_ptr<Graph>, Permutation> load_graph(
+			const Options &options, bool weighted = false) {
+		std::shared_ptr<Graph> graph;
+		if (options.generator) {
+			const auto start = omp_get_wtime();
+			graph = std::make_shared<Graph>(generate_graph(
+						*options.generator, 128, 128));
+			std::cout << "Generated "
+				<< graph_model_name(options.generator->model)
+				<< " graph of size " << graph->get_dimensions() << " with "
+				<< graph->get_num_edges() << " edges in "
+				<< omp_get_wtime() - start << "s" << std::endl;
+		} else if (Graph::is_tile_file(options.graph_path)) {
+			graph = std::make_shared<Graph>(Graph::open_tiles(
+						options.graph_path, stream_block_size(options),
+						weighted));
+			std::cout << "Opened tile file of size "
+				<< graph->get_dimensions() << " with "
+				<< graph->get_num_edges() << " edges" << std::endl;
+		} else {
+			graph = std::make_shared<Graph>(options.graph_path, 128, 128,
+					weighted || !options.stream_path.empty());
+			std::cout << "Read graph of size " << graph->get_dimensions() << std::endl;
+		}
+
+		if (options.ordering == Ordering::None)
+			return std::make_tuple(graph, Permutation{});
+
+		const auto tiles_before = graph->get_num_nonempty_subgraphs();
+		auto perm = compute_ordering(*graph, options.ordering);
+		graph->relabel(perm.new_id);
+		const auto tiles_after = graph->get_num_nonempty_subgraphs();
+
+		std::cout << "Reordered graph (" << ordering_name(options.ordering)
+			<< "): non-empty tiles " << tiles_before << " -> "
+			<< tiles_after << " ("
+			<< 100.0 * (1.0 - static_cast<double>(tiles_after) /
+					static_cast<double>(tiles_before))
+			<< "% reduction)" << std::endl;
+		return std::make_tuple(graph, std::move(perm));
+	}
+
+	// Largest weight that quantized cells of both approaches store
+	// exactly. A row's exponent then is at most 0, so every integer
+	// weight up to it is a code, and a weight of 0 stays below the
+	// distances' resolution.
+	float max_exact_weight(const CrossbarOptions &graphr_crossbar,
+			const CrossbarOptions &sparse_mem_crossbar) {
+		const auto index_bits = static_cast<int>(
+				std::bit_width(sparse_mem_crossbar.num_cols - 1));
+		return static_cast<float>(std::min(
+					max_code(graphr_crossbar.datatype_size),
+					max_code(sparse_mem_crossbar.datatype_size -
+						index_bits) - 1));
+	}
+
+	// Quantized weights only give the same distances in both approaches
+	// if they are exact, see max_exact_weight, so exits on any other.
+	void check_quantized_weights(const Graph &graph,
+			const CrossbarOptions &graphr_crossbar,
+			const CrossbarOptions &sparse_mem_crossbar) {
+		const auto max_weight = max_exact_weight(graphr_crossbar,
+				sparse_mem_crossbar);
+		auto exact = [max_weight] (const std::vector<float> &weights) {
+			for (auto weight : weights) {
+				if (weight < 0 || weight > max_weight ||
+						weight != std::floor(weight))
+					return false;
+			}
+			return true;
+		};
+
+		bool all_exact = true;
+		if (!graph.is_compressed()) {
+			all_exact = graph.visit_edges([&] (const auto &edges) {
+				return exact(edges.weights);
+			});
+		} else {
+			const auto sizes = graph.get_subgraph_sizes();
+			SubGraph tile;
+			for (size_t subgraph = 0; all_exact &&
+					subgraph < sizes.size(); subgraph++) {
+				if (!sizes[subgraph])
+					continue;
+				graph.get_subgraph_at(subgraph, tile);
+				all_exact = exact(tile.weights);
+			}
+		}
+
+		if (!all_exact) {
+			std::cout << "Quantized SSSP needs integer weights from 0 to "
+				<< max_weight << std::endl;
+			exit(1);
+		}
+	}
 }
 
 template<typename T>
@@ -30,30 +362,53 @@ void add_vectors(std::vector<T> &a, const std::vector<T> &b) {
 		a[i] += b[i];
 }
 
-void run_sssp(char **argv) {
-	if (!argv[1]) {
-		std::cout << "Please input a graph!" << std::endl;
-		exit(1);
+// Runs a traversal from up to 64 sources at once. Every vertex carries a
+// frontier bit and a distance per source, so each tile is extracted and
+// programmed once per iteration for the whole batch.
+void run_batched_traversal(const Options &opts,
+		const CrossbarOptions &graphr_crossbar,
+		const CrossbarOptions &sparse_mem_crossbar, bool weighted) {
+	auto [graph, perm] = load_graph(opts, weighted);
+	if (weighted && opts.quantize)
+		check_quantized_weights(*graph, graphr_crossbar,
+				sparse_mem_crossbar);
+
+	std::vector<size_t> sources;
+	for (auto source : opts.sources) {
+		if (source >= graph->get_dimensions()) {
+			std::cout << "Source " << source << " is not in the graph"
+				<< std::endl;
+			exit(1);
+		}
+		sources.push_back(perm.to_new(source));
 	}
-
-	auto graph = std::make_shared<Graph>(argv[1], 128, 128);
-	std::cout << "Read graph of size " << graph->get_dimensions() << std::endl;
+	store_tiles(opts, *graph, weighted);
 
 	struct Data {
-		Data(unsigned int start, size_t graph_dimension,
+		Data(const std::vector<size_t> &sources, size_t graph_dimension,
 				size_t crossbar_size)
 			: is_active(true),
-			active_nodes(round_up(graph_dimension, crossbar_size), false),
-			changed_nodes(round_up(graph_dimension, crossbar_size), false),
-			d(round_up(graph_dimension, crossbar_size),
+			batch(sources.size()),
+			active_nodes(round_up(graph_dimension, crossbar_size), 0),
+			changed_nodes(round_up(graph_dimension, crossbar_size), 0),
+			d(round_up(graph_dimension, crossbar_size) * sources.size(),
 					std::numeric_limits<short>::max())
 		{
-			d[start] = 0;
-			active_nodes[start] = true;
+			for (size_t s = 0; s < batch; s++) {
+				d[sources[s] * batch + s] = 0;
+				active_nodes[sources[s]] |= uint64_t(1) << s;
+			}
+		}
+		// Members the tiles read or change, see
+		// Experiment::set_processes.
+		auto state() {
+			return std::tie(is_active, active_nodes, changed_nodes, d);
 		}
 		bool is_active;
-		std::vector<bool> active_nodes;
-		std::vector<bool> changed_nodes;
+		size_t batch;
+		std::vector<uint64_t> active_nodes;
+		std::vector<uint64_t> changed_nodes;
+		// The distance of vertex v from source s is d[v * batch + s].
 		std::vector<short> d;
 	};
 
@@ -62,13 +417,31 @@ void run_sssp(char **argv) {
 	};
 
 	auto row_func = [] (Data &data, size_t real_row)
-		-> std::optional<short> {
-			if (!data.active_nodes[real_row])
+		-> std::optional<BatchInput> {
+			const auto mask = data.active_nodes[real_row];
+			if (!mask)
 				return std::nullopt;
-			data.is_active = true;
-			return data.d[real_row];
+			set_active(data.is_active);
+			return BatchInput{mask, real_row};
 		};
 
+	auto relax = [] (Data &data, const BatchInput &input, size_t j,
+			short weight) {
+		auto mask = input.mask;
+		while (mask) {
+			const auto s = std::countr_zero(mask);
+			mask &= mask - 1;
+
+			auto &dist = data.d[j * data.batch + s];
+			const auto new_dist = static_cast<short>(load_distance(
+					data.d[input.row * data.batch + s]) + weight);
+			if (new_dist < dist) {
+				store_distance(dist, new_dist);
+				data.changed_nodes[j] |= uint64_t(1) << s;
+			}
+		}
+	};
+
 	auto aggregate_func = [min] (Data &data,
 			const std::vector<Data> &local_datas) -> bool {
 		for (auto &local_data : local_datas) {
@@ -81,51 +454,40 @@ void run_sssp(char **argv) {
 
 		data.active_nodes = data.changed_nodes;
 		std::fill(data.changed_nodes.begin(),
-				data.changed_nodes.end(), false);
+				data.changed_nodes.end(), 0);
 
 		return data.is_active;
 	};
 
-	auto same_subgraph = [] (const SubGraph &subgraph, Data &data) {
-		return subgraph;
+	auto same_subgraph = [] (SubGraph &subgraph, Data &data) {};
+
+	// Splits the interleaved distances into one vector per source, indexed
+	// by original vertex id.
+	auto per_source = [&perm] (const Data &data) {
+		std::vector<std::vector<short>> result(data.batch);
+		for (size_t s = 0; s < data.batch; s++) {
+			std::vector<short> d(data.d.size() / data.batch);
+			for (size_t v = 0; v < d.size(); v++)
+				d[v] = data.d[v * data.batch + s];
+			result[s] = perm.restore(d);
+		}
+		return result;
 	};
 
-	std::vector<short> graphr_result;
-	Stats graphr_stats;
+	auto graphr_elem_func = [relax] (Data &data, Graphr<false>::Data &elem,
+			size_t j, const BatchInput &input) {
+		if (elem.weight == std::numeric_limits<float>::max())
+			return;
+		relax(data, input, j, static_cast<short>(elem.weight));
+	};
 
-	{
+	auto sparse_mem_elem_func = [relax] (Data &data, size_t j,
+			const BatchInput &input, float weight) {
+		relax(data, input, j, static_cast<short>(weight));
+	};
 
-		auto elem_func = [] (Data &data, Graphr<false>::Data &elem, size_t j) {
-			auto old_d = data.d[j];
-			auto int_val = (short)elem.weight;
-			if (elem.weight == std::numeric_limits<float>::max())
-				int_val = std::numeric_limits<short>::max();
-			data.d[j] = std::min(old_d, int_val);
-			if (data.d[j] != old_d)
-				data.changed_nodes[j] = true;
-		};
-		CrossbarOptions options;
-		options.num_rows = 128;
-		options.num_cols = 128;
-		options.cols_per_adc = 2;
-		options.datatype_size = 16;
-		options.input_size = 16;	
-		options.read_device = ADC;
-		options.read_latency = READ_TIME;
-		options.read_energy = READ_ENERGY;
-		options.write_latency = WRITE_TIME;
-		options.write_energy = WRITE_ENERGY;
-		options.adc_latency = ADC_LATENCY;
-		options.adc_energy = ADC_ENERGY;
-		options.sa_latency = SA_LATENCY;
-		options.sa_energy = SA_ENERGY;
-		options.static_energy = STATIC_ENERGY;
-		options.static_latency = STATIC_LATENCY;
-		options.dynamic_energy = 0;
-		options.dynamic_latency = 0;
-		Experiment<Graphr<false>, Data> experiment(options, 5U,
-				graph->get_dimensions(), 128LU);
-		experiment.set_graph(graph);
+	auto iterate = [&] (auto &experiment, auto elem_func) {
+		configure_experiment(opts, experiment, graph);
 
 		auto &data = experiment.get_data();
 
@@ -137,95 +499,100 @@ void run_sssp(char **argv) {
 			std::cout << "is_active: " << is_active << std::endl;
 		}
 
-		graphr_result = data.d;
-		graphr_stats = experiment.get_stats();
-	}
+		print_traversal_time(opts, experiment);
+		print_estimate(opts, experiment);
+		return per_source(data);
+	};
 
-	std::vector<short> sparse_mem_result;
-	Stats sparse_mem_stats;
+	std::vector<std::vector<short>> graphr_result;
+	Stats graphr_stats, sparse_mem_stats;
 
-	std::cout << "START OF SPARSEMEM SIMULATION" << std::endl;
+	if (opts.fused) {
+		Experiment<Fused<Graphr<false>, SparseMEM<false>>, Data> experiment(
+				{graphr_crossbar, sparse_mem_crossbar}, sources,
+				graph->get_dimensions(), 128LU);
+		graphr_result = iterate(experiment, graphr_elem_func);
 
-	{
-		auto elem_func = [] (Data &data, size_t j, short input) {
-			auto old_d = data.d[j];
-			data.d[j] = std::min(old_d, static_cast<short>(input + 1));
-			if (data.d[j] != old_d)
-				data.changed_nodes[j] = true;
-		};
+		graphr_stats = experiment.get_stats();
+		sparse_mem_stats = get_secondary_stats(experiment);
+	} else {
+		{
+			Experiment<Graphr<false>, Data> experiment(graphr_crossbar,
+					sources, graph->get_dimensions(), 128LU);
+			graphr_result = iterate(experiment, graphr_elem_func);
+			graphr_stats = experiment.get_stats();
+		}
 
-		CrossbarOptions options;
-		options.num_rows = 128;
-		options.num_cols = 128;
-		options.cols_per_adc = 0.25;
-		options.datatype_size = 16;
-		options.input_size = 0;
-		options.read_device = SA;
-		options.read_latency = READ_TIME;
-		options.read_energy = READ_ENERGY;
-		options.write_latency = WRITE_TIME;
-		options.write_energy = WRITE_ENERGY;
-		options.adc_latency = ADC_LATENCY;
-		options.adc_energy = ADC_ENERGY;
-		options.sa_latency = SA_LATENCY;
-		options.sa_energy = SA_ENERGY;
-		options.static_energy = 0;
-		options.static_latency = 0;
-		options.dynamic_energy = DYNAMIC_ENERGY;
-		options.dynamic_latency = DYNAMIC_LATENCY;
-		Experiment<SparseMEM<false>, Data> experiment(options, 5U,
-				graph->get_dimensions(), 128LU);
-		experiment.set_graph(graph);
+		std::vector<std::vector<short>> sparse_mem_result;
 
-		auto &data = experiment.get_data();
+		std::cout << "START OF SPARSEMEM SIMULATION" << std::endl;
 
-		bool is_active = true;
-		while (is_active) {
-			data.is_active = false;
-			experiment.run_kernel(row_func, elem_func, same_subgraph);
-			is_active = experiment.aggregate_data(aggregate_func);
-			std::cout << "is_active: " << is_active << std::endl;
+		{
+			Experiment<SparseMEM<false>, Data> experiment(sparse_mem_crossbar,
+					sources, graph->get_dimensions(), 128LU);
+			sparse_mem_result = iterate(experiment, sparse_mem_elem_func);
+			sparse_mem_stats = experiment.get_stats();
 		}
 
-		sparse_mem_result = data.d;
-		sparse_mem_stats = experiment.get_stats();
+		assert(graphr_result == sparse_mem_result);
 	}
 
-	assert(graphr_result.size() == sparse_mem_result.size());
-	for (size_t i = 0; i < graphr_result.size(); i++)
-		assert(graphr_result[i] == sparse_mem_result[i]);
-
-	std::cout << "Graphr stats: " << std::endl;
-	graphr_stats.print();
+	for (size_t s = 0; s < opts.sources.size(); s++) {
+		size_t reached = 0;
+		short depth = 0;
+		for (auto dist : graphr_result[s]) {
+			if (dist == std::numeric_limits<short>::max())
+				continue;
+			reached++;
+			depth = std::max(depth, dist);
+		}
+		std::cout << "source " << opts.sources[s] << ": reached "
+			<< reached << ", depth " << depth << std::endl;
+	}
 
-	std::cout << "SparseMEM stats: " << std::endl;
-	sparse_mem_stats.print();
+	print_stats(graphr_stats, sparse_mem_stats);
 }
 
-void run_bfs(char **argv) {
-	if (!argv[1]) {
-		std::cout << "Please input a graph!" << std::endl;
-		exit(1);
+// Single source BFS/SSSP, which only differ in their crossbar options and
+// in whether edge weights are read. With direction_optimizing, large
+// frontiers are expanded bottom-up. A non-zero delta runs delta-stepping
+// with buckets of that width.
+void run_traversal(const Options &opts,
+		const CrossbarOptions &graphr_crossbar,
+		const CrossbarOptions &sparse_mem_crossbar, bool weighted,
+		bool direction_optimizing = false, unsigned int delta = 0) {
+	if (!opts.sources.empty()) {
+		run_batched_traversal(opts, graphr_crossbar, sparse_mem_crossbar,
+				weighted);
+		return;
 	}
 
-	auto graph = std::make_shared<Graph>(argv[1], 128, 128);
-	std::cout << "Read graph of size " << graph->get_dimensions() << std::endl;
+	auto [graph, perm] = load_graph(opts, weighted);
+	if (weighted && opts.quantize)
+		check_quantized_weights(*graph, graphr_crossbar,
+				sparse_mem_crossbar);
+	const auto start = static_cast<unsigned int>(perm.to_new(5));
 
 	struct Data {
 		Data(unsigned int start, size_t graph_dimension,
 				size_t crossbar_size)
 			: is_active(true),
-			active_nodes(round_up(graph_dimension, crossbar_size), false),
-			changed_nodes(round_up(graph_dimension, crossbar_size), false),
+			active_nodes(round_up(graph_dimension, crossbar_size),
+					crossbar_size),
+			changed_nodes(round_up(graph_dimension, crossbar_size),
+					crossbar_size),
 			d(round_up(graph_dimension, crossbar_size),
 					std::numeric_limits<short>::max())
 		{
 			d[start] = 0;
-			active_nodes[start] = true;
+			active_nodes.insert(start);
+		}
+		auto state() {
+			return std::tie(is_active, active_nodes, changed_nodes, d);
 		}
 		bool is_active;
-		std::vector<bool> active_nodes;
-		std::vector<bool> changed_nodes;
+		Frontier active_nodes;
+		Frontier changed_nodes;
 		std::vector<short> d;
 	};
 
@@ -235,131 +602,304 @@ void run_bfs(char **argv) {
 
 	auto row_func = [] (Data &data, size_t real_row)
 		-> std::optional<short> {
-			if (!data.active_nodes[real_row])
+			if (!data.active_nodes.test(real_row))
 				return std::nullopt;
-			data.is_active = true;
-			return data.d[real_row];
+			set_active(data.is_active);
+			return load_distance(data.d[real_row]);
 		};
 
 	auto aggregate_func = [min] (Data &data,
 			const std::vector<Data> &local_datas) -> bool {
 		for (auto &local_data : local_datas) {
 			data.is_active |= local_data.is_active;
-			vector_binop(data.changed_nodes,
-					local_data.changed_nodes,
-					std::bit_or<void>());
+			data.changed_nodes.merge(local_data.changed_nodes);
 			vector_binop(data.d, local_data.d, min);
 		}
 
-		data.active_nodes = data.changed_nodes;
-		std::fill(data.changed_nodes.begin(),
-				data.changed_nodes.end(), false);
+		std::swap(data.active_nodes, data.changed_nodes);
+		data.changed_nodes.clear();
 
 		return data.is_active;
 	};
 
-	auto same_subgraph = [] (const SubGraph &subgraph, Data &data) {
-		return subgraph;
-	};
-
-	std::vector<short> graphr_result;
-	Stats graphr_stats;
-
-	{
+	auto same_subgraph = [] (SubGraph &subgraph, Data &data) {};
 
-		auto elem_func = [] (Data &data, Graphr<false>::Data &elem, size_t j) {
+	auto graphr_elem_func = overloaded{
+		[] (Data &data, Graphr<false>::Data &elem, size_t j) {
 			auto old_d = data.d[j];
 			auto int_val = (short)elem.weight;
 			if (elem.weight == std::numeric_limits<float>::max())
 				int_val = std::numeric_limits<short>::max();
-			data.d[j] = std::min(old_d, int_val);
-			if (data.d[j] != old_d)
-				data.changed_nodes[j] = true;
+			if (int_val < old_d) {
+				store_distance(data.d[j], int_val);
+				data.changed_nodes.insert(j);
+			}
+		},
+		// Whole output row: the candidates and the mask of improved
+		// columns are computed 64 columns at a time without branches,
+		// only improved distances are stored.
+		[] (Data &data, std::span<Graphr<false>::Data> cells, size_t col) {
+			for (size_t base = 0; base < cells.size(); base += 64) {
+				const auto len = std::min<size_t>(64, cells.size() - base);
+				const auto *d = &data.d[col + base];
+				short next[64];
+				uint64_t changed = 0;
+
+				#pragma omp simd reduction(|:changed)
+				for (size_t k = 0; k < len; k++) {
+					// Empty cells hold the max float.
+					next[k] = static_cast<short>(std::min(
+								cells[base + k].weight,
+								float(std::numeric_limits<short>::max())));
+					changed |= uint64_t(next[k] < d[k]) << k;
+				}
+
+				for (auto bits = changed; bits; bits &= bits - 1) {
+					const auto k = std::countr_zero(bits);
+					store_distance(data.d[col + base + k], next[k]);
+				}
+				data.changed_nodes.insert_bits(col + base, changed);
+			}
+		}
+	};
+
+	auto sparse_mem_elem_func = [] (Data &data, size_t j, short input,
+			float weight) {
+		auto old_d = data.d[j];
+		const auto new_d = static_cast<short>(input + weight);
+		if (new_d < old_d) {
+			store_distance(data.d[j], new_d);
+			data.changed_nodes.insert(j);
+		}
+	};
+
+	std::shared_ptr<Graph> transposed;
+	std::vector<size_t> out_degrees, in_degrees;
+	if (direction_optimizing) {
+		transposed = std::make_shared<Graph>(graph->transposed());
+		// Padded like the vertex data, the padding is never reached.
+		out_degrees.resize(round_up(graph->get_dimensions(), 128LU));
+		in_degrees.resize(round_up(graph->get_dimensions(), 128LU));
+		graph->visit_edges([&] (const auto &edges) {
+			for (size_t k = 0; k < edges.size(); k++) {
+				out_degrees[edges.src[k]]++;
+				in_degrees[edges.dst[k]]++;
+			}
+		});
+		store_tiles(opts, *transposed, weighted, ".transposed");
+	}
+	store_tiles(opts, *graph, weighted);
+
+	// Bottom-up steps run on the transposed graph, so every row is an
+	// unvisited vertex which looks for a parent among its in-neighbours in
+	// the frontier. The row is passed along as a single query batch.
+	// Vertices without in-neighbours can never be reached and are not
+	// read at all.
+	auto pull_row_func = [&in_degrees] (Data &data, size_t real_row)
+		-> std::optional<BatchInput> {
+			if (data.d[real_row] != std::numeric_limits<short>::max() ||
+					!in_degrees[real_row])
+				return std::nullopt;
+			return BatchInput{1, real_row};
 		};
-		CrossbarOptions options;
-		options.num_rows = 128;
-		options.num_cols = 128;
-		options.cols_per_adc = 2;
-		options.datatype_size = 1;
-		options.input_size = 8;	
-		options.read_device = ADC;
-		options.read_latency = READ_TIME;
-		options.read_energy = READ_ENERGY;
-		options.write_latency = WRITE_TIME;
-		options.write_energy = WRITE_ENERGY;
-		options.adc_latency = ADC_LATENCY;
-		options.adc_energy = ADC_ENERGY;
-		options.sa_latency = SA_LATENCY;
-		options.sa_energy = SA_ENERGY;
-		options.static_energy = STATIC_ENERGY;
-		options.static_latency = STATIC_LATENCY;
-		options.dynamic_energy = 0;
-		options.dynamic_latency = 0;
-		Experiment<Graphr<false>, Data> experiment(options, 5U,
-				graph->get_dimensions(), 128LU);
-		experiment.set_graph(graph);
+
+	auto pull = [] (Data &data, size_t parent, size_t v, short weight) {
+		if (!data.active_nodes.test(parent))
+			return;
+		const auto new_d = static_cast<short>(data.d[parent] + weight);
+		if (new_d < data.d[v]) {
+			data.d[v] = new_d;
+			data.changed_nodes.insert(v);
+			set_active(data.is_active);
+		}
+	};
+
+	auto graphr_pull_elem_func = [pull] (Data &data,
+			Graphr<false>::Data &elem, size_t j, const BatchInput &input) {
+		if (elem.weight == std::numeric_limits<float>::max())
+			return;
+		pull(data, j, input.row, static_cast<short>(elem.weight));
+	};
+
+	auto sparse_mem_pull_elem_func = [pull] (Data &data, size_t j,
+			const BatchInput &input, float weight) {
+		pull(data, j, input.row, static_cast<short>(weight));
+	};
+
+	// Delta-stepping keeps every vertex whose distance improved in the
+	// bucket d / delta until its edges are relaxed. Each sweep relaxes the
+	// pending vertices of the lowest non-empty bucket, and tiles without
+	// any of them in their row block are skipped. Vertices that land in
+	// the same bucket again are relaxed in the next sweep, so a bucket is
+	// settled before the next one starts.
+	Frontier pending, later;
+
+	auto next_bucket = [delta, &pending, &later] (Data &data)
+		-> std::optional<size_t> {
+		pending.merge(data.active_nodes);
+		if (pending.empty())
+			return std::nullopt;
+
+		auto lowest = std::numeric_limits<size_t>::max();
+		pending.for_each([&] (size_t v) {
+			lowest = std::min(lowest, data.d[v] / size_t(delta));
+		});
+
+		data.active_nodes.clear();
+		later.clear();
+		pending.for_each([&] (size_t v) {
+			if (data.d[v] / size_t(delta) == lowest)
+				data.active_nodes.insert(v);
+			else
+				later.insert(v);
+		});
+		std::swap(pending, later);
+		return lowest;
+	};
+
+	auto active_tile = [] (size_t row, size_t col, Data &data) -> bool {
+		return data.active_nodes.any_in_block(row);
+	};
+
+	auto iterate = [&] (auto &experiment, auto elem_func,
+			auto pull_elem_func) {
+		configure_experiment(opts, experiment, graph);
 
 		auto &data = experiment.get_data();
 
+		Stats push_stats, pull_stats;
+		size_t push_steps = 0, pull_steps = 0;
+		bool bottom_up = false;
+
+		pending = Frontier(data.d.size(), 128);
+		later = Frontier(data.d.size(), 128);
+		size_t bucket = std::numeric_limits<size_t>::max();
+		size_t num_buckets = 0, num_sweeps = 0;
+
 		bool is_active = true;
 		while (is_active) {
 			data.is_active = false;
-			experiment.run_kernel(row_func, elem_func, same_subgraph);
+
+			if (delta) {
+				const auto next = next_bucket(data);
+				if (!next)
+					break;
+				num_buckets += *next != bucket;
+				bucket = *next;
+				num_sweeps++;
+			}
+
+			if (direction_optimizing) {
+				// Beamer's heuristic: go bottom-up once the edges out
+				// of the frontier outweigh those into unvisited
+				// vertices, and back when the frontier gets small. An
+				// empty frontier always goes back, also on graphs with
+				// fewer than BFS_BETA vertices.
+				const auto frontier = data.active_nodes.count();
+				size_t frontier_edges = 0, unvisited_edges = 0;
+				data.active_nodes.for_each([&] (size_t v) {
+					frontier_edges += out_degrees[v];
+				});
+				for (size_t v = 0; v < graph->get_dimensions(); v++) {
+					if (data.d[v] == std::numeric_limits<short>::max())
+						unvisited_edges += in_degrees[v];
+				}
+
+				const bool next = bottom_up ?
+					frontier > graph->get_dimensions() / BFS_BETA :
+					frontier_edges > unvisited_edges / BFS_ALPHA;
+				if (next != bottom_up)
+					experiment.set_graph(next ? transposed : graph);
+				bottom_up = next;
+				// Bottom-up steps write the distance of their row.
+				experiment.set_owner_computes(opts.owner_computes &&
+						!bottom_up);
+			}
+
+			const auto before = experiment.get_stats();
+			if (delta)
+				experiment.run_kernel(row_func, elem_func, same_subgraph,
+						active_tile);
+			else if (bottom_up)
+				experiment.run_kernel(pull_row_func, pull_elem_func,
+						same_subgraph);
+			else
+				experiment.run_kernel(row_func, elem_func, same_subgraph);
 			is_active = experiment.aggregate_data(aggregate_func);
 			std::cout << "is_active: " << is_active << std::endl;
+			// A sweep that settles nothing only moves on to the next
+			// bucket, the run ends once next_bucket finds none.
+			if (delta)
+				is_active = true;
+
+			auto step_stats = experiment.get_stats();
+			step_stats -= before;
+			if (bottom_up) {
+				pull_stats += step_stats;
+				pull_steps++;
+			} else {
+				push_stats += step_stats;
+				push_steps++;
+			}
 		}
 
-		graphr_result = data.d;
+		if (delta) {
+			const auto reached = std::count_if(data.d.begin(),
+					data.d.end(), [] (short d) {
+				return d != std::numeric_limits<short>::max();
+			});
+			std::cout << "Delta-stepping settled " << num_buckets
+				<< " buckets in " << num_sweeps << " sweeps, reaching "
+				<< reached << " vertices" << std::endl;
+		}
+
+		if (direction_optimizing) {
+			std::cout << "Top-down stats (" << push_steps << " steps): "
+				<< std::endl;
+			push_stats.print();
+			std::cout << "Bottom-up stats (" << pull_steps << " steps): "
+				<< std::endl;
+			pull_stats.print();
+		}
+
+		print_traversal_time(opts, experiment);
+		print_estimate(opts, experiment);
+		return perm.restore(data.d);
+	};
+
+	Stats graphr_stats, sparse_mem_stats;
+
+	if (opts.fused) {
+		Experiment<Fused<Graphr<false>, SparseMEM<false>>, Data> experiment(
+				{graphr_crossbar, sparse_mem_crossbar}, start,
+				graph->get_dimensions(), 128LU);
+		iterate(experiment, graphr_elem_func, graphr_pull_elem_func);
+
 		graphr_stats = experiment.get_stats();
+		sparse_mem_stats = get_secondary_stats(experiment);
+		print_stats(graphr_stats, sparse_mem_stats);
+		return;
 	}
 
-	std::vector<short> sparse_mem_result;
-	Stats sparse_mem_stats;
-
-	std::cout << "START OF SPARSEMEM SIMULATION" << std::endl;
+	std::vector<short> graphr_result;
 
 	{
-		auto elem_func = [] (Data &data, size_t j, short input) {
-			auto old_d = data.d[j];
-			data.d[j] = std::min(old_d, static_cast<short>(input + 1));
-			if (data.d[j] != old_d)
-				data.changed_nodes[j] = true;
-		};
-
-		CrossbarOptions options;
-		options.num_rows = 128;
-		options.num_cols = 128;
-		options.cols_per_adc = 0.25;
-		options.datatype_size = 9;
-		options.input_size = 0;
-		options.read_device = SA;
-		options.read_latency = READ_TIME;
-		options.read_energy = READ_ENERGY;
-		options.write_latency = WRITE_TIME;
-		options.write_energy = WRITE_ENERGY;
-		options.adc_latency = ADC_LATENCY;
-		options.adc_energy = ADC_ENERGY;
-		options.sa_latency = SA_LATENCY;
-		options.sa_energy = SA_ENERGY;
-		options.static_energy = 0;
-		options.static_latency = 0;
-		options.dynamic_energy = DYNAMIC_ENERGY;
-		options.dynamic_latency = DYNAMIC_LATENCY;
-		Experiment<SparseMEM <false>, Data> experiment(options, 5U,
+		Experiment<Graphr<false>, Data> experiment(graphr_crossbar, start,
 				graph->get_dimensions(), 128LU);
-		experiment.set_graph(graph);
+		graphr_result = iterate(experiment, graphr_elem_func,
+				graphr_pull_elem_func);
+		graphr_stats = experiment.get_stats();
+	}
 
-		auto &data = experiment.get_data();
+	std::vector<short> sparse_mem_result;
 
-		bool is_active = true;
-		while (is_active) {
-			data.is_active = false;
-			experiment.run_kernel(row_func, elem_func, same_subgraph);
-			is_active = experiment.aggregate_data(aggregate_func);
-			std::cout << "is_active: " << is_active << std::endl;
-		}
+	std::cout << "START OF SPARSEMEM SIMULATION" << std::endl;
 
-		sparse_mem_result = data.d;
+	{
+		Experiment<SparseMEM<false>, Data> experiment(sparse_mem_crossbar,
+				start, graph->get_dimensions(), 128LU);
+		sparse_mem_result = iterate(experiment, sparse_mem_elem_func,
+				sparse_mem_pull_elem_func);
 		sparse_mem_stats = experiment.get_stats();
 	}
 
@@ -367,29 +907,31 @@ void run_bfs(char **argv) {
 	for (size_t i = 0; i < graphr_result.size(); i++)
 		assert(graphr_result[i] == sparse_mem_result[i]);
 
-	std::cout << "Graphr stats: " << std::endl;
-	graphr_stats.print();
+	print_stats(graphr_stats, sparse_mem_stats);
+}
 
-	std::cout << "SparseMEM stats: " << std::endl;
-	sparse_mem_stats.print();
+void run_sssp(const Options &opts) {
+	run_traversal(opts, graphr_options(2, 16, 16, opts.quantize),
+			sparse_mem_options(16, opts.quantize),
+			true, false, opts.delta);
 }
 
-void run_pagerank(char **argv) {
-	if (!argv[1]) {
-		std::cout << "Please input a graph!" << std::endl;
-		exit(1);
-	}
+void run_bfs(const Options &opts) {
+	run_traversal(opts, graphr_options(2, 1, 8, opts.quantize),
+			sparse_mem_options(9, opts.quantize),
+			false, opts.direction_optimizing);
+}
 
+void run_pagerank(const Options &opts) {
 	const double r = 0.85f;
 	const double tol = 1e-9;
 	const int max_iterations = 100;
 
-	auto graph = std::make_shared<Graph>(argv[1], 128, 128);
-	std::cout << "Read graph of size " << graph->get_dimensions() << std::endl;
+	auto [graph, perm] = load_graph(opts);
+	const auto start = static_cast<unsigned int>(perm.to_new(5));
 
-	std::vector<int> degrees(graph->get_dimensions());
-	for (const auto &t : graph->get_tuples())
-		degrees[t.i]++;
+	const auto degrees = graph->get_out_degrees();
+	store_tiles(opts, *graph, false);
 
 	struct Data {
 		Data(unsigned int start, size_t graph_dimension,
@@ -403,6 +945,9 @@ void run_pagerank(char **argv) {
 			new_score(round_up(graph_dimension, crossbar_size))
 		{
 		}
+		auto state() {
+			return std::tie(iterations, new_score);
+		}
 		int iterations;
 		size_t graph_dimension;
 		double teleport_prob;
@@ -411,10 +956,16 @@ void run_pagerank(char **argv) {
 	};
 
 
+	const bool delta = opts.pagerank_delta > 0;
+
 	// Should just return the current score
-	auto row_func = [r] (Data &data)
+	auto row_func = [r, delta] (Data &data)
 		-> std::optional<double> {
 			assert(data.graph_dimension);
+			// Delta sweeps only carry residuals, the teleport term was
+			// added by the first sweep.
+			if (delta && data.iterations)
+				return 0.0;
 			return (1.0f - r) / (double)data.graph_dimension;
 	};
 
@@ -441,129 +992,617 @@ void run_pagerank(char **argv) {
 		return !converged;
 	};
 
-	auto degree = [r, &degrees] (const SubGraph &subgraph, Data &data) {
-		SubGraph new_subgraph = subgraph;
+	// Every edge of source i carries r * score[i] / degree[i]. The scale is
+	// computed once per iteration and applied when the tiles are written.
+	// Worker processes of --processes see the scales of every iteration.
+	SharedSegment row_scale_memory(graph->get_dimensions() * sizeof(float));
+	const auto row_scale = row_scale_memory.get_array<float>();
+	auto update_row_scale = [r, &degrees, &row_scale] (const Data &data) {
+		#pragma omp parallel for
+		for (size_t i = 0; i < row_scale.size(); i++) {
+			if (!degrees[i]) {
+				row_scale[i] = 0;
+				continue;
+			}
+			row_scale[i] = (r * (float)data.score[i] /
+					(float)degrees[i]);
+			assert(!std::isnan(row_scale[i]));
+			assert(!std::isinf(row_scale[i]));
+		}
+	};
+
+	auto degree = [&row_scale] (SubGraph &subgraph, Data &data) {
+		subgraph.row_scale = row_scale;
+	};
 
-		for (auto &t : new_subgraph.tuples) {
-			t.weight = (r * (float)data.score[t.i] /
-					(float)degrees[t.i]);
-			assert(!std::isnan(t.weight));
-			assert(!std::isinf(t.weight));
+	// Delta mode: after one full sweep only the change (residual) of each
+	// source is propagated. Sources whose pending residual is at most the
+	// threshold keep it for later, and tiles without any other source are
+	// skipped. The L1 distance to the fixed point is bounded by
+	// r / (1 - r) times the pending residual, so this threshold keeps the
+	// result within opts.pagerank_delta of it.
+	const double threshold = opts.pagerank_delta * (1 - r) /
+		static_cast<double>(graph->get_dimensions());
+	std::vector<double> residual;
+	SharedSegment active_block_memory(
+			round_up(graph->get_dimensions(), 128LU) / 128);
+	const auto active_blocks = active_block_memory.get_array<char>();
+
+	auto update_delta_scale = [r, threshold, &degrees, &row_scale,
+			&residual] () {
+		#pragma omp parallel for
+		for (size_t i = 0; i < row_scale.size(); i++) {
+			row_scale[i] = 0;
+			if (!degrees[i]) {
+				residual[i] = 0;
+				continue;
+			}
+			if (std::abs(residual[i]) <= threshold)
+				continue;
+
+			row_scale[i] = (r * (float)residual[i] /
+					(float)degrees[i]);
+			residual[i] = 0;
 		}
-		return new_subgraph;
 	};
 
-	std::vector<double> graphr_result;
-	Stats graphr_stats;
+	auto delta_aggregate_func = [threshold, max_iterations, &degrees,
+			&residual, &active_blocks] (Data &data,
+			const std::vector<Data> &local_datas) -> bool {
+		for (auto &local_data : local_datas)
+			add_vectors(data.new_score, local_data.new_score);
+
+		if (!data.iterations) {
+			// The first sweep is a full one, its change seeds the
+			// residuals.
+			for (size_t i = 0; i < data.score.size(); i++)
+				residual[i] = data.new_score[i] - data.score[i];
+			data.score = std::move(data.new_score);
+		} else {
+			for (size_t i = 0; i < data.score.size(); i++) {
+				data.score[i] += data.new_score[i];
+				residual[i] += data.new_score[i];
+			}
+		}
+		data.new_score.clear();
+		data.new_score.resize(data.score.size());
 
-	{
+		size_t active_rows = 0;
+		std::fill(active_blocks.begin(), active_blocks.end(), false);
+		for (size_t i = 0; i < degrees.size(); i++) {
+			if (degrees[i] && std::abs(residual[i]) > threshold) {
+				active_blocks[i / 128] = true;
+				active_rows++;
+			}
+		}
+		std::cout << "active rows: " << active_rows << std::endl;
+
+		data.iterations++;
+		return active_rows && data.iterations < max_iterations;
+	};
+
+	auto active_tile = [&active_blocks] (size_t row, size_t col,
+			Data &data) -> bool {
+		return row < active_blocks.size() && active_blocks[row];
+	};
+
+	// Gauss-Seidel mode: a finished column strip publishes its scores and
+	// row scales right away, so tiles processed later in the same sweep
+	// already use them.
+	std::vector<double> previous_score;
+
+	auto commit_strip = [r, &degrees, &row_scale] (size_t col,
+			Data &data) {
+		const auto first = col * 128;
+		const auto last = std::min(first + 128, data.score.size());
+		for (size_t v = first; v < last; v++) {
+			data.score[v] = data.new_score[v];
+			data.new_score[v] = 0;
+			if (v >= degrees.size() || !degrees[v])
+				continue;
+
+			std::atomic_ref<float> scale(row_scale[v]);
+			scale.store(r * (float)data.score[v] / (float)degrees[v],
+					std::memory_order_relaxed);
+		}
+	};
+
+	auto live_degree = [&row_scale] (SubGraph &subgraph, Data &data) {
+		thread_local std::vector<float> tile_scale;
 
-		auto elem_func = [] (Data &data, Graphr<true>::Data &elem, size_t j) {
+		const auto first = subgraph.row_offset;
+		const auto last = std::min(first + subgraph.dimensions,
+				row_scale.size());
+		tile_scale.resize(subgraph.dimensions);
+		for (size_t v = first; v < last; v++) {
+			std::atomic_ref<float> scale(row_scale[v]);
+			tile_scale[v - first] = scale.load(std::memory_order_relaxed);
+		}
+		subgraph.row_scale = tile_scale;
+		subgraph.row_scale_base = first;
+	};
+
+	auto in_place_aggregate_func = [tol, max_iterations, &previous_score]
+			(Data &data, const std::vector<Data> &local_datas) -> bool {
+		double error = 0;
+		for (size_t i = 0; i < data.score.size(); i++)
+			error += std::abs(data.score[i] - previous_score[i]);
+		std::cout << "error: " << error << std::endl;
+
+		data.iterations++;
+		return error >= tol && data.iterations < max_iterations;
+	};
+
+	auto graphr_elem_func = overloaded{
+		[] (Data &data, Graphr<true>::Data &elem, size_t j) {
 			assert(!std::isinf(data.new_score[j]));
 			assert(!std::isinf(elem.weight));
 			data.new_score[j] += elem.weight;
-		};
-		CrossbarOptions options;
-		options.num_rows = 128;
-		options.num_cols = 128;
-		options.cols_per_adc = 4;
-		options.datatype_size = 8;
-		options.input_size = 8;	
-		options.read_device = ADC;
-		options.read_latency = READ_TIME;
-		options.read_energy = READ_ENERGY;
-		options.write_latency = WRITE_TIME;
-		options.write_energy = WRITE_ENERGY;
-		options.adc_latency = ADC_LATENCY;
-		options.adc_energy = ADC_ENERGY;
-		options.sa_latency = SA_LATENCY;
-		options.sa_energy = SA_ENERGY;
-		options.static_energy = STATIC_ENERGY;
-		options.static_latency = STATIC_LATENCY;
-		options.dynamic_energy = 0;
-		options.dynamic_latency = 0;
-		Experiment<Graphr<true>, Data> experiment(options, 5U,
-				graph->get_dimensions(), 128LU);
-		experiment.set_graph(graph);
+		},
+		[] (Data &data, std::span<Graphr<true>::Data> cells, size_t col) {
+			auto *score = &data.new_score[col];
+			#pragma omp simd
+			for (size_t k = 0; k < cells.size(); k++)
+				score[k] += cells[k].weight;
+		}
+	};
+
+	auto sparse_mem_elem_func = [] (Data &data, size_t j, float input) {
+		data.new_score[j] += input;
+	};
+
+	auto iterate = [&] (auto &experiment, auto elem_func) {
+		configure_experiment(opts, experiment, graph);
 
 		auto &data = experiment.get_data();
+		residual.assign(data.score.size(), 0);
+		std::fill(active_blocks.begin(), active_blocks.end(), true);
 
 		bool is_active = true;
 		while (is_active) {
-			experiment.run_kernel(row_func, elem_func, degree);
-			is_active = experiment.aggregate_data(aggregate_func);
+			if (opts.gauss_seidel) {
+				if (!data.iterations)
+					update_row_scale(data);
+				previous_score = data.score;
+				experiment.run_kernel_in_place(row_func, elem_func,
+						live_degree, commit_strip);
+				is_active = experiment.aggregate_data(
+						in_place_aggregate_func);
+			} else if (delta) {
+				if (data.iterations)
+					update_delta_scale();
+				else
+					update_row_scale(data);
+				experiment.run_kernel(row_func, elem_func, degree,
+						active_tile);
+				is_active = experiment.aggregate_data(
+						delta_aggregate_func);
+			} else {
+				update_row_scale(data);
+				experiment.run_kernel(row_func, elem_func, degree);
+				is_active = experiment.aggregate_data(aggregate_func);
+			}
 			std::cout << "is_active: " << is_active << std::endl;
 		}
+		std::cout << "PageRank finished after " << data.iterations
+			<< " iterations" << std::endl;
+
+		print_traversal_time(opts, experiment);
+		print_estimate(opts, experiment);
+		return perm.restore(data.score);
+	};
+
+	Stats graphr_stats, sparse_mem_stats;
+
+	if (opts.fused) {
+		Experiment<Fused<Graphr<true>, SparseMEM<true>>, Data> experiment(
+				{graphr_options(4, 8, 8, opts.quantize),
+					sparse_mem_options(9, opts.quantize)}, start,
+				graph->get_dimensions(), 128LU);
+		iterate(experiment, graphr_elem_func);
 
-		graphr_result = data.score;
 		graphr_stats = experiment.get_stats();
+		sparse_mem_stats = get_secondary_stats(experiment);
+		print_stats(graphr_stats, sparse_mem_stats);
+		return;
 	}
 
-	std::vector<double> sparse_mem_result;
-	Stats sparse_mem_stats;
-
-	std::cout << "START OF SPARSEMEM SIMULATION" << std::endl;
+	std::vector<double> graphr_result;
 
 	{
-		auto elem_func = [] (Data &data, size_t j, float input) {
-			data.new_score[j] += input;
-		};
-
-		CrossbarOptions options;
-		options.num_rows = 128;
-		options.num_cols = 128;
-		options.cols_per_adc = 0.25;
-		options.datatype_size = 9;
-		options.input_size = 0;
-		options.read_device = SA;
-		options.read_latency = READ_TIME;
-		options.read_energy = READ_ENERGY;
-		options.write_latency = WRITE_TIME;
-		options.write_energy = WRITE_ENERGY;
-		options.adc_latency = ADC_LATENCY;
-		options.adc_energy = ADC_ENERGY;
-		options.sa_latency = SA_LATENCY;
-		options.sa_energy = SA_ENERGY;
-		options.static_energy = 0;
-		options.static_latency = 0;
-		options.dynamic_energy = DYNAMIC_ENERGY;
-		options.dynamic_latency = DYNAMIC_LATENCY;
-		Experiment<SparseMEM<true>, Data> experiment(options, 5U,
-				graph->get_dimensions(), 128LU);
-		experiment.set_graph(graph);
+		Experiment<Graphr<true>, Data> experiment(graphr_options(4, 8, 8,
+					opts.quantize),
+				start, graph->get_dimensions(), 128LU);
+		graphr_result = iterate(experiment, graphr_elem_func);
+		graphr_stats = experiment.get_stats();
+	}
 
-		auto &data = experiment.get_data();
+	std::vector<double> sparse_mem_result;
 
-		bool is_active = true;
-		while (is_active) {
-			experiment.run_kernel(row_func, elem_func, degree);
-			is_active = experiment.aggregate_data(aggregate_func);
-			std::cout << "is_active: " << is_active << std::endl;
-		}
+	std::cout << "START OF SPARSEMEM SIMULATION" << std::endl;
 
-		sparse_mem_result = data.score;
+	{
+		Experiment<SparseMEM<true>, Data> experiment(sparse_mem_options(9,
+					opts.quantize),
+				start, graph->get_dimensions(), 128LU);
+		sparse_mem_result = iterate(experiment, sparse_mem_elem_func);
 		sparse_mem_stats = experiment.get_stats();
 	}
 
 	assert(graphr_result.size() == sparse_mem_result.size());
+	double max_difference = 0;
 	for (size_t i = 0; i < graphr_result.size(); i++) {
-		if (std::abs(graphr_result[i] - sparse_mem_result[i]) >= 0.0000001f)
+		const auto difference = std::abs(graphr_result[i] - sparse_mem_result[i]);
+		max_difference = std::max(max_difference, difference);
+		if (opts.quantize)
+			continue;
+		if (difference >= 0.0000001f)
 			std::cout << i << ": " << graphr_result[i] << ", " << sparse_mem_result[i] << std::endl;
-		assert(std::abs(graphr_result[i] - sparse_mem_result[i]) < 0.0000001f);
+		assert(difference < 0.0000001f);
 	}
+	if (opts.quantize)
+		std::cout << "Quantized scores differ by up to " << max_difference
+			<< std::endl;
+
+	print_stats(graphr_stats, sparse_mem_stats);
+}
 
-	std::cout << "Graphr stats: " << std::endl;
-	graphr_stats.print();
+// Operations of a pass over the tiles for one approach, from the cache if
+// it has them. Otherwise they are counted on the graph, which is loaded on
+// first use, and stored.
+template <typename Approach, bool MultiRow>
+CrossbarCounters get_pass_counters(const Options &opts,
+		const TileCostCache &cache, TileCostKey key,
+		std::shared_ptr<Graph> &graph, const CrossbarOptions &options) {
+	key.num_rows = options.num_rows;
+	key.num_cols = options.num_cols;
+
+	auto costs = cache.load(key);
+	const bool cached = costs.has_value();
+	if (!cached) {
+		if (!graph)
+			graph = std::get<0>(load_graph(opts));
+		costs = derive_tile_costs<Approach, MultiRow>(*graph, options);
+		cache.store(key, *costs);
+	}
 
-	std::cout << "SparseMEM stats: " << std::endl;
-	sparse_mem_stats.print();
+	std::cout << "Tile costs (" << key.approach << "): "
+		<< (cached ? "cached" : "derived") << ", " << costs->ids.size()
+		<< " tiles" << std::endl;
+	return costs->total();
 }
+
+// Prints the Stats of one pass over all tiles, each written once and all of
+// its rows read once, with the crossbars of every algorithm. Traversals and
+// PageRank read rows differently, so they have their own tile costs. The
+// algorithms themselves never use these costs, see --cost-cache.
+void run_pass_costs(const Options &opts) {
+	const TileCostCache cache(opts.cost_cache);
+	const TileCostKey key{graph_hash(opts), ordering_name(opts.ordering),
+		0, 0, ""};
+	std::shared_ptr<Graph> graph;
+
+	auto with_approach = [&key] (const char *approach) {
+		auto approach_key = key;
+		approach_key.approach = approach;
+		return approach_key;
+	};
+
+	const auto graphr = get_pass_counters<Graphr<false>, false>(opts, cache,
+			with_approach("graphr"), graph,
+			graphr_options(2, 16, 16, opts.quantize));
+	const auto sparse_mem = get_pass_counters<SparseMEM<false>, false>(opts,
+			cache, with_approach("sparsemem"), graph,
+			sparse_mem_options(16, opts.quantize));
+	const auto graphr_pagerank = get_pass_counters<Graphr<true>, true>(opts,
+			cache, with_approach("graphr-pagerank"), graph,
+			graphr_options(4, 8, 8, opts.quantize));
+	const auto sparse_mem_pagerank = get_pass_counters<SparseMEM<true>,
+		true>(opts, cache, with_approach("sparsemem-pagerank"), graph,
+				sparse_mem_options(9, opts.quantize));
+
+	std::cout << "SSSP pass" << std::endl;
+	print_stats(counted_stats(graphr_options(2, 16, 16, opts.quantize),
+				graphr),
+			counted_stats(sparse_mem_options(16, opts.quantize),
+				sparse_mem));
+	std::cout << "BFS pass" << std::endl;
+	print_stats(counted_stats(graphr_options(2, 1, 8, opts.quantize), graphr),
+			counted_stats(sparse_mem_options(9, opts.quantize),
+				sparse_mem));
+	std::cout << "PageRank pass" << std::endl;
+	print_stats(counted_stats(graphr_options(4, 8, 8, opts.quantize),
+				graphr_pagerank),
+			counted_stats(sparse_mem_options(9, opts.quantize),
+				sparse_mem_pagerank));
+}
+
+void usage(const char *name) {
+	std::cout << "Usage: " << name << " [options] <graph>" << std::endl
+		<< "       " << name << " [options] -G <spec>" << std::endl
+		<< "\t-o, --ordering <none|degree|rcm|community>" << std::endl
+		<< "\t\treorder vertices before tiling" << std::endl
+		<< "\t-t, --tile-order <column|row|morton|hilbert>" << std::endl
+		<< "\t\torder in which threads walk the tile grid" << std::endl
+		<< "\t-p, --pipeline-depth <n>" << std::endl
+		<< "\t\tprepare up to n tiles ahead of each kernel thread" << std::endl
+		<< "\t-d, --pagerank-delta <tolerance>" << std::endl
+		<< "\t\tpropagate PageRank residuals only, within tolerance (L1)" << std::endl
+		<< "\t-g, --gauss-seidel" << std::endl
+		<< "\t\tupdate PageRank scores in place during each sweep" << std::endl
+		<< "\t-s, --sources <v1,v2,...>" << std::endl
+		<< "\t\trun BFS and SSSP from up to 64 sources at once" << std::endl
+		<< "\t-f, --fused" << std::endl
+		<< "\t\tsimulate Graphr and SparseMEM in a single pass over the tiles" << std::endl
+		<< "\t-G, --generate <rmat|er>:<scale>[:<edge factor>[:<seed>]]" << std::endl
+		<< "\t\tgenerate a synthetic graph instead of reading one" << std::endl
+		<< "\t-P[counters], --profile[=counters]" << std::endl
+		<< "\t\tprint host time per phase, optionally with hardware counters" << std::endl
+		<< "\t-r, --sample-rate <fraction>" << std::endl
+		<< "\t\testimate Stats from a stratified sample of the tiles" << std::endl
+		<< "\t-D, --direction-optimizing" << std::endl
+		<< "\t\tswitch BFS between top-down and bottom-up steps" << std::endl
+		<< "\t-S, --delta-stepping <delta>" << std::endl
+		<< "\t\trun SSSP by delta-stepping with buckets of width delta" << std::endl
+		<< "\t-c, --owner-computes" << std::endl
+		<< "\t\tlet threads own column strips instead of copying the data" << std::endl
+		<< "\t-z, --compress-tiles" << std::endl
+		<< "\t\tkeep the graph as compressed tiles instead of edges" << std::endl
+		<< "\t-T, --stream <file>" << std::endl
+		<< "\t\twrite the compressed tiles to file and stream them from there" << std::endl
+		<< "\t-B, --stream-budget <MiB>" << std::endl
+		<< "\t\tmemory for reading streamed tiles, 256 by default" << std::endl
+		<< "\t-n, --processes <n>" << std::endl
+		<< "\t\trun the tiles in n forked processes instead of threads" << std::endl
+		<< "\t-a, --pin <none|close|spread>" << std::endl
+		<< "\t\tpin threads to CPUs, filling or alternating NUMA nodes" << std::endl
+		<< "\t-q, --quantize" << std::endl
+		<< "\t\tstore crossbar cells bit-packed at their simulated width" << std::endl
+		<< "\t-K, --cost-cache <dir>" << std::endl
+		<< "\t\tprint the Stats of a tile pass, cached in dir, instead of running" << std::endl;
+}
+
 int main(int argc, char **argv) {
+	static const struct option long_options[] = {
+		{"ordering", required_argument, nullptr, 'o'},
+		{"tile-order", required_argument, nullptr, 't'},
+		{"pipeline-depth", required_argument, nullptr, 'p'},
+		{"pagerank-delta", required_argument, nullptr, 'd'},
+		{"gauss-seidel", no_argument, nullptr, 'g'},
+		{"sources", required_argument, nullptr, 's'},
+		{"fused", no_argument, nullptr, 'f'},
+		{"generate", required_argument, nullptr, 'G'},
+		{"profile", optional_argument, nullptr, 'P'},
+		{"sample-rate", required_argument, nullptr, 'r'},
+		{"direction-optimizing", no_argument, nullptr, 'D'},
+		{"delta-stepping", required_argument, nullptr, 'S'},
+		{"owner-computes", no_argument, nullptr, 'c'},
+		{"compress-tiles", no_argument, nullptr, 'z'},
+		{"stream", required_argument, nullptr, 'T'},
+		{"stream-budget", required_argument, nullptr, 'B'},
+		{"processes", required_argument, nullptr, 'n'},
+		{"pin", required_argument, nullptr, 'a'},
+		{"quantize", no_argument, nullptr, 'q'},
+		{"cost-cache", required_argument, nullptr, 'K'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0}
+	};
+
+	Options options;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "o:t:p:d:gs:fG:P::r:DS:czT:B:n:a:qK:h", long_options,
+					nullptr)) != -1) {
+		switch (opt) {
+			case 'o': {
+				auto ordering = parse_ordering(optarg);
+				if (!ordering) {
+					std::cout << "Unknown ordering: " << optarg << std::endl;
+					exit(1);
+				}
+				options.ordering = *ordering;
+				break;
+			}
+			case 't': {
+				auto order = parse_tile_order(optarg);
+				if (!order) {
+					std::cout << "Unknown tile order: " << optarg << std::endl;
+					exit(1);
+				}
+				options.tile_order = *order;
+				break;
+			}
+			case 'p':
+				options.pipeline_depth = std::stoul(optarg);
+				break;
+			case 'd': {
+				const auto delta = parse_number<double>(optarg);
+				if (!delta || !std::isfinite(*delta) || *delta < 0) {
+					std::cout << "Invalid PageRank tolerance: " << optarg
+						<< std::endl;
+					exit(1);
+				}
+				options.pagerank_delta = *delta;
+				break;
+			}
+			case 'g':
+				options.gauss_seidel = true;
+				break;
+			case 's': {
+				std::string list = optarg;
+				size_t pos = 0;
+				while (pos < list.size()) {
+					auto end = list.find(',', pos);
+					if (end == std::string::npos)
+						end = list.size();
+					options.sources.push_back(std::stoul(
+								list.substr(pos, end - pos)));
+					pos = end + 1;
+				}
+				if (options.sources.empty() || options.sources.size() > 64) {
+					std::cout << "Between 1 and 64 sources are supported"
+						<< std::endl;
+					exit(1);
+				}
+				break;
+			}
+			case 'f':
+				options.fused = true;
+				break;
+			case 'G':
+				options.generator = parse_generator(optarg);
+				if (!options.generator) {
+					std::cout << "Invalid generator: " << optarg << std::endl;
+					exit(1);
+				}
+				break;
+			case 'P':
+				if (optarg && std::string(optarg) != "counters") {
+					std::cout << "Unknown profile mode: " << optarg << std::endl;
+					exit(1);
+				}
+				Profiler::get().enable(optarg);
+				break;
+			case 'r': {
+				const auto rate = parse_number<double>(optarg);
+				if (!rate || !(*rate >= 0 && *rate <= 1)) {
+					std::cout << "The sample rate must be between 0 and 1"
+						<< std::endl;
+					exit(1);
+				}
+				options.sample_rate = *rate;
+				break;
+			}
+			case 'D':
+				options.direction_optimizing = true;
+				break;
+			case 'S': {
+				const auto delta = parse_number<unsigned int>(optarg);
+				if (!delta || !*delta) {
+					std::cout << "The bucket width must be a positive "
+						"integer" << std::endl;
+					exit(1);
+				}
+				options.delta = *delta;
+				break;
+			}
+			case 'c':
+				options.owner_computes = true;
+				break;
+			case 'z':
+				options.compress_tiles = true;
+				break;
+			case 'T':
+				options.stream_path = optarg;
+				break;
+			case 'B': {
+				// In MiB, which have to fit a size_t in bytes.
+				const auto max_budget = std::numeric_limits<size_t>::max() >> 20;
+				const auto budget = parse_number<size_t>(optarg);
+				if (!budget || !*budget || *budget > max_budget) {
+					std::cout << "The stream budget must be a positive "
+						"number of MiB" << std::endl;
+					exit(1);
+				}
+				options.stream_budget = *budget << 20;
+				break;
+			}
+			case 'n': {
+				const auto processes = parse_number<size_t>(optarg);
+				if (!processes) {
+					std::cout << "Invalid number of processes: " << optarg
+						<< std::endl;
+					exit(1);
+				}
+				options.processes = *processes;
+				break;
+			}
+			case 'a': {
+				auto pinning = parse_pinning(optarg);
+				if (!pinning) {
+					std::cout << "Unknown pinning: " << optarg << std::endl;
+					exit(1);
+				}
+				options.pinning = *pinning;
+				break;
+			}
+			case 'q':
+				options.quantize = true;
+				break;
+			case 'K':
+				options.cost_cache = optarg;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+
+	if (optind < argc) {
+		options.graph_path = argv[optind];
+	} else if (!options.generator) {
+		std::cout << "Please input a graph!" << std::endl;
+		exit(1);
+	}
+
+	if (options.gauss_seidel && options.pagerank_delta > 0) {
+		std::cout << "--gauss-seidel and --pagerank-delta are exclusive"
+			<< std::endl;
+		exit(1);
+	}
+
+	if (options.sample_rate > 0 && (options.gauss_seidel || options.fused ||
+				options.owner_computes)) {
+		std::cout << "--sample-rate works with neither --gauss-seidel, "
+			"--fused nor --owner-computes" << std::endl;
+		exit(1);
+	}
+
+	if (options.processes > 1 && (options.gauss_seidel || options.fused ||
+				options.owner_computes || options.sample_rate > 0 ||
+				options.pipeline_depth)) {
+		std::cout << "--processes works with neither --gauss-seidel, "
+			"--fused, --owner-computes, --sample-rate nor "
+			"--pipeline-depth" << std::endl;
+		exit(1);
+	}
+
+	if (options.graph_path && Graph::is_tile_file(options.graph_path) &&
+			(options.ordering != Ordering::None ||
+			 options.direction_optimizing)) {
+		std::cout << "Tile files work with neither --ordering nor "
+			"--direction-optimizing" << std::endl;
+		exit(1);
+	}
+
+	if (options.delta && !options.sources.empty()) {
+		std::cout << "--delta-stepping does not support --sources"
+			<< std::endl;
+		exit(1);
+	}
+
+	pin_threads(options.pinning);
+	if (options.pinning != Pinning::None)
+		std::cout << "Pinned " << omp_get_max_threads() << " threads ("
+			<< pinning_name(options.pinning) << ") over "
+			<< Topology::get().get_num_nodes() << " NUMA nodes"
+			<< std::endl;
+
+	if (!options.cost_cache.empty()) {
+		run_pass_costs(options);
+		Profiler::get().print_summary();
+		return 0;
+	}
+
 	std::cout << "Running SSSP" << std::endl;
-	run_sssp(argv);
+	run_sssp(options);
 	std::cout << "Running BFS" << std::endl;
-	run_bfs(argv);
+	run_bfs(options);
 	std::cout << "Running PageRank" << std::endl;
-	run_pagerank(argv);
+	run_pagerank(options);
+
+	Profiler::get().print_summary();
 	return 0;
 }
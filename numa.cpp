@@ -0,0 +1,194 @@
+#include "numa.hpp"
+
+#include <sched.h>
+#include <fstream>
+#include <stdexcept>
+#include <omp.h>
+
+namespace {
+	Pinning current_pinning = Pinning::None;
+
+	// Parses a sysfs list like "0-3,8-11".
+	std::vector<int> parse_list(const std::string &list) {
+		std::vector<int> values;
+		size_t pos = 0;
+		while (pos < list.size()) {
+			auto end = list.find(',', pos);
+			if (end == std::string::npos)
+				end = list.size();
+			const auto range = list.substr(pos, end - pos);
+			const auto dash = range.find('-');
+			const auto first = std::stoi(range.substr(0, dash));
+			const auto last = dash == std::string::npos ? first :
+				std::stoi(range.substr(dash + 1));
+			for (auto v = first; v <= last; v++)
+				values.push_back(v);
+			pos = end + 1;
+		}
+		return values;
+	}
+
+	std::vector<int> read_list(const std::string &path) {
+		std::ifstream file(path);
+		std::string list;
+		if (!std::getline(file, list))
+			return {};
+		return parse_list(list);
+	}
+
+	int cpu_of_thread(size_t t) {
+		const auto &topology = Topology::get();
+		const auto num_nodes = topology.get_num_nodes();
+		if (current_pinning == Pinning::Spread) {
+			const auto &cpus = topology.get_cpus(t % num_nodes);
+			return cpus[(t / num_nodes) % cpus.size()];
+		}
+
+		size_t num_cpus = 0;
+		for (size_t node = 0; node < num_nodes; node++)
+			num_cpus += topology.get_cpus(node).size();
+		auto k = t % num_cpus;
+		for (size_t node = 0;; node++) {
+			const auto &cpus = topology.get_cpus(node);
+			if (k < cpus.size())
+				return cpus[k];
+			k -= cpus.size();
+		}
+	}
+
+	// Skips as many CPUs past that of t as threads are pinned to its
+	// node, wrapping around. A node with a single CPU has to share it.
+	int cpu_of_helper(size_t t, size_t num_threads) {
+		const auto &topology = Topology::get();
+		const auto cpu = cpu_of_thread(t);
+		const auto node = topology.get_node(cpu);
+		const auto &cpus = topology.get_cpus(node);
+
+		size_t used = 0;
+		for (size_t u = 0; u < num_threads; u++) {
+			if (topology.get_node(cpu_of_thread(u)) == node)
+				used++;
+		}
+		auto offset = used % cpus.size();
+		if (!offset)
+			offset = 1;
+
+		size_t k = 0;
+		while (cpus[k] != cpu)
+			k++;
+		return cpus[(k + offset) % cpus.size()];
+	}
+
+	void pin_current_thread_to(int cpu, size_t t) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set))
+			throw std::runtime_error("cannot pin thread " +
+					std::to_string(t));
+	}
+}
+
+std::optional<Pinning> parse_pinning(const std::string &name) {
+	if (name == "none")
+		return Pinning::None;
+	if (name == "close")
+		return Pinning::Close;
+	if (name == "spread")
+		return Pinning::Spread;
+	return std::nullopt;
+}
+
+const char *pinning_name(Pinning pinning) {
+	switch (pinning) {
+		case Pinning::None:
+			return "none";
+		case Pinning::Close:
+			return "close";
+		case Pinning::Spread:
+			return "spread";
+	}
+	return "unknown";
+}
+
+const Topology &Topology::get() {
+	static Topology topology;
+	return topology;
+}
+
+Topology::Topology() {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		throw std::runtime_error("cannot read the CPU affinity");
+
+	const std::string base = "/sys/devices/system/node/";
+	for (auto node : read_list(base + "online")) {
+		std::vector<int> cpus;
+		for (auto cpu : read_list(base + "node" + std::to_string(node) +
+					"/cpulist")) {
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+				cpus.push_back(cpu);
+		}
+		if (!cpus.empty())
+			_node_cpus.push_back(std::move(cpus));
+	}
+
+	// No NUMA support, or none of the allowed CPUs were listed.
+	if (_node_cpus.empty()) {
+		_node_cpus.emplace_back();
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed))
+				_node_cpus[0].push_back(cpu);
+		}
+	}
+
+	for (size_t node = 0; node < _node_cpus.size(); node++) {
+		for (auto cpu : _node_cpus[node]) {
+			if (static_cast<size_t>(cpu) >= _cpu_nodes.size())
+				_cpu_nodes.resize(cpu + 1);
+			_cpu_nodes[cpu] = node;
+		}
+	}
+}
+
+size_t Topology::get_node(int cpu) const {
+	if (cpu < 0 || static_cast<size_t>(cpu) >= _cpu_nodes.size())
+		return 0;
+	return _cpu_nodes[cpu];
+}
+
+void pin_threads(Pinning pinning) {
+	// The topology has to be read while the process may still use all of
+	// its CPUs.
+	Topology::get();
+	current_pinning = pinning;
+	if (pinning == Pinning::None)
+		return;
+
+	bool failed = false;
+	#pragma omp parallel reduction(||:failed)
+	{
+		try {
+			pin_current_thread(omp_get_thread_num());
+		} catch (const std::runtime_error &) {
+			failed = true;
+		}
+	}
+	if (failed)
+		throw std::runtime_error("cannot pin the threads");
+}
+
+void pin_current_thread(size_t t) {
+	if (current_pinning == Pinning::None)
+		return;
+
+	pin_current_thread_to(cpu_of_thread(t), t);
+}
+
+void pin_current_helper(size_t t, size_t num_threads) {
+	if (current_pinning == Pinning::None)
+		return;
+
+	pin_current_thread_to(cpu_of_helper(t, num_threads), t);
+}
@@ -0,0 +1,61 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <stddef.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class Pinning {
+	// Leave thread placement to the OS.
+	None,
+	// Fill the CPUs of one NUMA node before moving on to the next.
+	Close,
+	// Deal the threads out to the nodes in turn.
+	Spread
+};
+
+std::optional<Pinning> parse_pinning(const std::string &name);
+const char *pinning_name(Pinning pinning);
+
+// NUMA nodes and their CPUs as found in sysfs, limited to the CPUs the
+// process was allowed to run on at the first call. Without NUMA support all
+// CPUs are on node 0.
+class Topology {
+public:
+	static const Topology &get();
+
+	size_t get_num_nodes() const {
+		return _node_cpus.size();
+	}
+
+	const std::vector<int> &get_cpus(size_t node) const {
+		return _node_cpus[node];
+	}
+
+	// Node of a CPU, 0 if it is unknown.
+	size_t get_node(int cpu) const;
+private:
+	Topology();
+
+	std::vector<std::vector<int>> _node_cpus;
+	std::vector<size_t> _cpu_nodes;
+};
+
+// Pins every thread of the OpenMP team to one CPU, and keeps the pinning for
+// pin_current_thread. Per-thread state is first touched by its owner, so it
+// then stays on the owner's node.
+void pin_threads(Pinning pinning);
+
+// Pins the calling thread where pin_threads put thread t, e.g. in a forked
+// worker, which only inherits the CPU of the thread that forked it. Does
+// nothing without pinning.
+void pin_current_thread(size_t t);
+
+// Pins the calling thread to another CPU on the node of thread t, so a
+// helper of t runs next to it instead of taking turns with it. Helpers of
+// the first num_threads threads take the CPUs of the node that follow those
+// of the threads. Does nothing without pinning.
+void pin_current_helper(size_t t, size_t num_threads);
+
+#endif // NUMA_HPP
@@ -0,0 +1,202 @@
+#include "profile.hpp"
+#include "numa.hpp"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <limits>
+
+namespace {
+	const char *PHASE_NAMES[NUM_PHASES] = {
+		"load", "sort", "extract", "subgraph", "expand", "kernel",
+		"aggregate", "barrier"
+	};
+
+	constexpr size_t CACHE_LINE_SIZE = 64;
+
+	const uint64_t COUNTER_CONFIGS[NUM_COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES
+	};
+
+	int open_counter(uint64_t config, int group_fd) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+	}
+
+	// Opens all counters for the calling thread as one group, returns the
+	// leader or -1.
+	int open_group() {
+		const auto leader = open_counter(COUNTER_CONFIGS[0], -1);
+		if (leader < 0)
+			return -1;
+
+		for (size_t k = 1; k < NUM_COUNTERS; k++) {
+			if (open_counter(COUNTER_CONFIGS[k], leader) < 0) {
+				close(leader);
+				return -1;
+			}
+		}
+		return leader;
+	}
+}
+
+void Profiler::enable(bool counters) {
+	_enabled = true;
+	// The pipelined tile walk runs two threads per kernel thread.
+	_slots.resize(2 * omp_get_max_threads());
+	const auto num_nodes = Topology::get().get_num_nodes();
+	for (auto &slot : _slots) {
+		slot.node_misses.resize(num_nodes);
+		slot.node_time.resize(num_nodes);
+	}
+
+	if (counters) {
+		const auto fd = open_group();
+		if (fd < 0) {
+			printf("perf_event_open is unavailable, profiling without "
+					"counters\n");
+			return;
+		}
+		close(fd);
+		_counters = true;
+	}
+}
+
+Profiler::Slot &Profiler::_get_slot() {
+	const auto t = static_cast<size_t>(omp_get_thread_num());
+	assert(t < _slots.size());
+	return _slots[t];
+}
+
+void Profiler::_open_counters(Slot &slot) {
+	// OpenMP may hand a thread number to a different OS thread in another
+	// team, and counters only follow the thread that opened them.
+	const auto tid = gettid();
+	if (slot.perf_tid == tid)
+		return;
+
+	if (slot.perf_fd >= 0)
+		close(slot.perf_fd);
+	slot.perf_fd = open_group();
+	slot.perf_tid = tid;
+}
+
+Counters Profiler::read_counters() {
+	auto &slot = _get_slot();
+	_open_counters(slot);
+
+	Counters counters{};
+	if (slot.perf_fd < 0)
+		return counters;
+
+	uint64_t values[NUM_COUNTERS + 1];
+	if (read(slot.perf_fd, values, sizeof(values)) != sizeof(values))
+		return counters;
+	std::copy(values + 1, values + 1 + NUM_COUNTERS, counters.begin());
+	return counters;
+}
+
+void Profiler::add(Phase phase, double seconds, const Counters &counters) {
+	auto &slot = _get_slot();
+	const auto p = static_cast<size_t>(phase);
+	slot.iteration_time[p] += seconds;
+	for (size_t k = 0; k < NUM_COUNTERS; k++)
+		slot.counters[p][k] += counters[k];
+
+	if (_counters) {
+		const auto node = Topology::get().get_node(sched_getcpu());
+		slot.node_misses[node] += counters[1];
+		slot.node_time[node] += seconds;
+	}
+}
+
+void Profiler::end_iteration() {
+	if (!_enabled)
+		return;
+
+	std::array<double, NUM_PHASES> slowest{};
+	for (auto &slot : _slots) {
+		for (size_t p = 0; p < NUM_PHASES; p++) {
+			slowest[p] = std::max(slowest[p], slot.iteration_time[p]);
+			slot.time[p] += slot.iteration_time[p];
+			slot.iteration_time[p] = 0;
+		}
+	}
+	_iterations.push_back(slowest);
+}
+
+void Profiler::print_summary() {
+	if (!_enabled)
+		return;
+
+	// Phases outside of an iteration, e.g. loading, are still pending.
+	end_iteration();
+
+	printf("Host profile (%zu iterations, %zu thread slots)\n",
+			_iterations.size(), _slots.size());
+	printf("%-10s %12s %13s %13s %12s", "phase", "total[s]",
+			"thread_min[s]", "thread_max[s]", "iter_max[s]");
+	if (_counters)
+		printf(" %16s %14s %14s", "cycles", "llc_misses", "branch_misses");
+	printf("\n");
+
+	for (size_t p = 0; p < NUM_PHASES; p++) {
+		double total = 0, thread_max = 0;
+		double thread_min = std::numeric_limits<double>::max();
+		Counters counters{};
+		for (auto &slot : _slots) {
+			total += slot.time[p];
+			thread_max = std::max(thread_max, slot.time[p]);
+			// Unused slots would hide any imbalance.
+			if (slot.time[p] > 0)
+				thread_min = std::min(thread_min, slot.time[p]);
+			for (size_t k = 0; k < NUM_COUNTERS; k++)
+				counters[k] += slot.counters[p][k];
+		}
+		if (thread_min == std::numeric_limits<double>::max())
+			thread_min = 0;
+
+		double iteration_max = 0;
+		for (auto &iteration : _iterations)
+			iteration_max = std::max(iteration_max, iteration[p]);
+
+		printf("%-10s %12.6f %13.6f %13.6f %12.6f", PHASE_NAMES[p], total,
+				thread_min, thread_max, iteration_max);
+		if (_counters)
+			printf(" %16lu %14lu %14lu", counters[0], counters[1],
+					counters[2]);
+		printf("\n");
+	}
+
+	if (!_counters)
+		return;
+
+	// Every miss moves a cache line from memory, so this is a lower bound
+	// of the traffic, over the time of the busiest thread on the node.
+	printf("Memory traffic per NUMA node, from last level cache misses\n");
+	printf("%-10s %16s %12s\n", "node", "bytes", "GB/s");
+	for (size_t node = 0; node < Topology::get().get_num_nodes(); node++) {
+		uint64_t bytes = 0;
+		double time = 0;
+		for (auto &slot : _slots) {
+			bytes += slot.node_misses[node] * CACHE_LINE_SIZE;
+			time = std::max(time, slot.node_time[node]);
+		}
+		printf("%-10zu %16lu %12.3f\n", node, bytes,
+				time > 0 ? bytes / time * 1e-9 : 0.0);
+	}
+}
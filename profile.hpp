@@ -0,0 +1,127 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <vector>
+#include <omp.h>
+
+// Host side phases of a simulation run.
+enum class Phase {
+	Load,
+	Sort,
+	Extract,
+	Subgraph,
+	Expand,
+	Kernel,
+	Aggregate,
+	// Time a thread spends waiting for the others at the end of a
+	// parallel tile walk.
+	Barrier
+};
+
+constexpr size_t NUM_PHASES = 8;
+constexpr size_t NUM_COUNTERS = 3;
+
+// Hardware counters read around each phase: cycles, last level cache misses
+// and branch misses.
+using Counters = std::array<uint64_t, NUM_COUNTERS>;
+
+// Collects wall-clock time, and optionally perf_event counters, per phase,
+// thread and iteration. Every thread only writes its own slot, iterations
+// are closed from the master thread. Disabled by default, in which case a
+// ScopedPhase costs a single branch.
+class Profiler {
+public:
+	static Profiler &get() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	// Counters are silently left out if perf_event_open is unavailable.
+	void enable(bool counters);
+
+	inline bool is_enabled() const {
+		return _enabled;
+	}
+
+	inline bool has_counters() const {
+		return _counters;
+	}
+
+	void add(Phase phase, double seconds, const Counters &counters);
+	Counters read_counters();
+
+	// Folds the current iteration into the totals.
+	void end_iteration();
+	void print_summary();
+private:
+	struct alignas(64) Slot {
+		std::array<double, NUM_PHASES> time{};
+		std::array<double, NUM_PHASES> iteration_time{};
+		std::array<Counters, NUM_PHASES> counters{};
+		// Last level cache misses and time per NUMA node the thread
+		// ran on.
+		std::vector<uint64_t> node_misses;
+		std::vector<double> node_time;
+		int perf_fd = -1;
+		int perf_tid = -1;
+	};
+
+	Slot &_get_slot();
+	void _open_counters(Slot &slot);
+
+	bool _enabled = false;
+	bool _counters = false;
+	std::vector<Slot> _slots;
+	// Slowest thread of every finished iteration, per phase.
+	std::vector<std::array<double, NUM_PHASES>> _iterations;
+};
+
+class ScopedPhase {
+public:
+	explicit ScopedPhase(Phase phase)
+	: _phase(phase)
+	{
+		auto &profiler = Profiler::get();
+		if (!profiler.is_enabled())
+			return;
+
+		_active = true;
+		if (profiler.has_counters())
+			_counters = profiler.read_counters();
+		_start = omp_get_wtime();
+	}
+
+	ScopedPhase(const ScopedPhase &) = delete;
+	ScopedPhase operator= (const ScopedPhase &) = delete;
+
+	~ScopedPhase() {
+		if (!_active)
+			return;
+
+		auto &profiler = Profiler::get();
+		const auto seconds = omp_get_wtime() - _start;
+		if (profiler.has_counters()) {
+			const auto end = profiler.read_counters();
+			for (size_t k = 0; k < NUM_COUNTERS; k++)
+				_counters[k] = end[k] - _counters[k];
+		}
+		profiler.add(_phase, seconds, _counters);
+	}
+private:
+	Phase _phase;
+	bool _active = false;
+	double _start = 0;
+	Counters _counters{};
+};
+
+// Runs f as the given phase and returns its result.
+template <typename F>
+inline auto profile_phase(Phase phase, F f) {
+	ScopedPhase scope(phase);
+	return f();
+}
+
+#endif // PROFILE_HPP
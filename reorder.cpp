@@ -0,0 +1,245 @@
+#include "reorder.hpp"
+
+#include <assert.h>
+#include <algorithm>
+#include <numeric>
+#include <parallel/algorithm>
+
+namespace {
+	constexpr int MAX_PROPAGATION_ROUNDS = 10;
+
+	inline size_t mix(size_t x) {
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		return x;
+	}
+
+	// Undirected view of the graph in CSR form. Reciprocal edges show up
+	// twice, which is fine for all orderings below.
+	struct Adjacency {
+		std::vector<size_t> offsets;
+		std::vector<size_t> neighbours;
+
+		size_t degree(size_t v) const {
+			return offsets[v + 1] - offsets[v];
+		}
+	};
+
+	Adjacency build_symmetric(const Graph &graph) {
+		const auto n = graph.get_dimensions();
+		Adjacency adj;
+		adj.offsets.resize(n + 1);
+
+		graph.visit_edges([&adj] (const auto &edges) {
+			#pragma omp parallel for
+			for (size_t k = 0; k < edges.size(); k++) {
+				const size_t i = edges.src[k], j = edges.dst[k];
+				if (i == j)
+					continue;
+				#pragma omp atomic
+				adj.offsets[i + 1]++;
+				#pragma omp atomic
+				adj.offsets[j + 1]++;
+			}
+		});
+		std::inclusive_scan(adj.offsets.begin(), adj.offsets.end(),
+				adj.offsets.begin());
+
+		adj.neighbours.resize(adj.offsets[n]);
+		std::vector<size_t> cursor(adj.offsets.begin(), adj.offsets.end() - 1);
+
+		graph.visit_edges([&adj, &cursor] (const auto &edges) {
+			#pragma omp parallel for
+			for (size_t k = 0; k < edges.size(); k++) {
+				const size_t i = edges.src[k], j = edges.dst[k];
+				if (i == j)
+					continue;
+				size_t pos;
+				#pragma omp atomic capture
+				pos = cursor[i]++;
+				adj.neighbours[pos] = j;
+				#pragma omp atomic capture
+				pos = cursor[j]++;
+				adj.neighbours[pos] = i;
+			}
+		});
+		return adj;
+	}
+
+	std::vector<size_t> degree_order(const Adjacency &adj) {
+		const auto n = adj.offsets.size() - 1;
+		std::vector<size_t> order(n);
+		std::iota(order.begin(), order.end(), 0);
+		__gnu_parallel::sort(order.begin(), order.end(),
+				[&adj] (size_t a, size_t b) {
+			if (adj.degree(a) == adj.degree(b))
+				return a < b;
+			return adj.degree(a) > adj.degree(b);
+		});
+		return order;
+	}
+
+	std::vector<size_t> rcm_order(const Adjacency &adj) {
+		const auto n = adj.offsets.size() - 1;
+		auto by_degree = [&adj] (size_t a, size_t b) {
+			if (adj.degree(a) == adj.degree(b))
+				return a < b;
+			return adj.degree(a) < adj.degree(b);
+		};
+
+		// Every component is started from its lowest degree vertex.
+		std::vector<size_t> starts(n);
+		std::iota(starts.begin(), starts.end(), 0);
+		__gnu_parallel::sort(starts.begin(), starts.end(), by_degree);
+
+		std::vector<size_t> order;
+		order.reserve(n);
+		std::vector<char> visited(n, false);
+		for (auto start : starts) {
+			if (visited[start])
+				continue;
+
+			visited[start] = true;
+			size_t head = order.size();
+			order.push_back(start);
+			while (head < order.size()) {
+				const auto v = order[head++];
+				const auto first = order.size();
+				for (size_t k = adj.offsets[v]; k < adj.offsets[v + 1]; k++) {
+					const auto u = adj.neighbours[k];
+					if (visited[u])
+						continue;
+					visited[u] = true;
+					order.push_back(u);
+				}
+				std::sort(order.begin() + first, order.end(), by_degree);
+			}
+		}
+
+		std::reverse(order.begin(), order.end());
+		return order;
+	}
+
+	std::vector<size_t> community_order(const Adjacency &adj) {
+		const auto n = adj.offsets.size() - 1;
+		std::vector<size_t> label(n), next_label(n);
+		std::iota(label.begin(), label.end(), 0);
+
+		// Synchronous label propagation: every vertex adopts the most
+		// frequent label among its neighbours. Ties keep the current label
+		// if possible and are otherwise broken by a hash, since always
+		// taking the smallest label floods whole components.
+		for (int round = 0; round < MAX_PROPAGATION_ROUNDS; round++) {
+			size_t changed = 0;
+
+			#pragma omp parallel reduction(+:changed)
+			{
+				std::vector<size_t> labels;
+
+				#pragma omp for schedule(dynamic, 1024)
+				for (size_t v = 0; v < n; v++) {
+					next_label[v] = label[v];
+					if (!adj.degree(v))
+						continue;
+
+					labels.clear();
+					for (size_t k = adj.offsets[v]; k < adj.offsets[v + 1]; k++)
+						labels.push_back(label[adj.neighbours[k]]);
+					std::sort(labels.begin(), labels.end());
+
+					size_t best = label[v], best_count = 0;
+					for (size_t k = 0; k < labels.size();) {
+						size_t end = k;
+						while (end < labels.size() && labels[end] == labels[k])
+							end++;
+
+						const auto count = end - k;
+						if (count > best_count || (count == best_count &&
+								best != label[v] &&
+								(labels[k] == label[v] ||
+								 mix(labels[k] ^ v) < mix(best ^ v)))) {
+							best = labels[k];
+							best_count = count;
+						}
+						k = end;
+					}
+
+					if (best != label[v]) {
+						next_label[v] = best;
+						changed++;
+					}
+				}
+			}
+
+			std::swap(label, next_label);
+			if (changed <= n / 1000)
+				break;
+		}
+
+		// Communities stay in order of their label, members keep their
+		// original relative order.
+		std::vector<size_t> order(n);
+		std::iota(order.begin(), order.end(), 0);
+		__gnu_parallel::sort(order.begin(), order.end(),
+				[&label] (size_t a, size_t b) {
+			if (label[a] == label[b])
+				return a < b;
+			return label[a] < label[b];
+		});
+		return order;
+	}
+}
+
+std::optional<Ordering> parse_ordering(const std::string &name) {
+	if (name == "none")
+		return Ordering::None;
+	if (name == "degree")
+		return Ordering::Degree;
+	if (name == "rcm")
+		return Ordering::RCM;
+	if (name == "community")
+		return Ordering::Community;
+	return std::nullopt;
+}
+
+const char *ordering_name(Ordering ordering) {
+	switch (ordering) {
+		case Ordering::None:
+			return "none";
+		case Ordering::Degree:
+			return "degree";
+		case Ordering::RCM:
+			return "rcm";
+		case Ordering::Community:
+			return "community";
+	}
+	return "unknown";
+}
+
+Permutation compute_ordering(const Graph &graph, Ordering ordering) {
+	Permutation perm;
+	if (ordering == Ordering::None)
+		return perm;
+
+	const auto adj = build_symmetric(graph);
+	switch (ordering) {
+		case Ordering::Degree:
+			perm.old_id = degree_order(adj);
+			break;
+		case Ordering::RCM:
+			perm.old_id = rcm_order(adj);
+			break;
+		case Ordering::Community:
+			perm.old_id = community_order(adj);
+			break;
+		default:
+			assert(!"What");
+	}
+
+	perm.new_id.resize(perm.old_id.size());
+	#pragma omp parallel for
+	for (size_t k = 0; k < perm.old_id.size(); k++)
+		perm.new_id[perm.old_id[k]] = k;
+	return perm;
+}
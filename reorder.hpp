@@ -0,0 +1,54 @@
+#ifndef REORDER_HPP
+#define REORDER_HPP
+
+#include "graph.hpp"
+
+#include <stddef.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class Ordering {
+	None,
+	// Descending total degree, so hubs share the first row and column
+	// blocks.
+	Degree,
+	// Reverse Cuthill-McKee on the symmetrised graph, which pulls edges
+	// towards the diagonal.
+	RCM,
+	// Groups vertices by community (label propagation) in the spirit of
+	// Rabbit order, so that intra-community edges land in the same tiles.
+	Community
+};
+
+struct Permutation {
+	// new_id[old vertex] and old_id[new vertex].
+	std::vector<size_t> new_id;
+	std::vector<size_t> old_id;
+
+	size_t to_new(size_t vertex) const {
+		return new_id.empty() ? vertex : new_id[vertex];
+	}
+
+	// Maps a vector indexed by new vertex ids back to the original ids.
+	// Entries past the graph dimension (crossbar padding) are kept as is.
+	template <typename T>
+	std::vector<T> restore(const std::vector<T> &values) const {
+		if (new_id.empty())
+			return values;
+
+		std::vector<T> result(values);
+		#pragma omp parallel for
+		for (size_t v = 0; v < new_id.size(); v++)
+			result[v] = values[new_id[v]];
+		return result;
+	}
+};
+
+std::optional<Ordering> parse_ordering(const std::string &name);
+const char *ordering_name(Ordering ordering);
+
+// Computes a vertex permutation for the graph, apply with Graph::relabel.
+Permutation compute_ordering(const Graph &graph, Ordering ordering);
+
+#endif // REORDER_HPP
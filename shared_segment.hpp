@@ -0,0 +1,127 @@
+#ifndef SHARED_SEGMENT_HPP
+#define SHARED_SEGMENT_HPP
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// Anonymous memory mapping that stays shared with every process forked after
+// it was created.
+class SharedSegment {
+public:
+	SharedSegment() = default;
+
+	explicit SharedSegment(size_t size)
+	: _size(size)
+	{
+		_data = mmap(nullptr, _size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (_data == MAP_FAILED)
+			throw std::runtime_error("cannot map shared segment");
+	}
+
+	SharedSegment(const SharedSegment &) = delete;
+	SharedSegment operator= (const SharedSegment &) = delete;
+
+	~SharedSegment() {
+		if (_data)
+			munmap(_data, _size);
+	}
+
+	std::byte *data() {
+		return static_cast<std::byte *>(_data);
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	// The segment as an array, e.g. for state the parent hands to worker
+	// processes outside their data.
+	template <typename T>
+	std::span<T> get_array() {
+		static_assert(std::is_trivially_copyable_v<T>);
+		return {reinterpret_cast<T *>(_data), _size / sizeof(T)};
+	}
+private:
+	void *_data = nullptr;
+	size_t _size = 0;
+};
+
+// Visitors for visit_state. Members are trivially copyable values or vectors
+// of them, and vectors keep their size while tiles run.
+struct StateSize {
+	size_t &size;
+
+	template <typename T>
+	void operator()(const T &value) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		size += sizeof(T);
+	}
+
+	template <typename T>
+	void operator()(const std::vector<T> &values) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		size += values.size() * sizeof(T);
+	}
+};
+
+struct StateWriter {
+	std::byte *out;
+
+	template <typename T>
+	void operator()(const T &value) {
+		memcpy(out, &value, sizeof(T));
+		out += sizeof(T);
+	}
+
+	template <typename T>
+	void operator()(const std::vector<T> &values) {
+		memcpy(out, values.data(), values.size() * sizeof(T));
+		out += values.size() * sizeof(T);
+	}
+};
+
+struct StateReader {
+	const std::byte *in;
+
+	template <typename T>
+	void operator()(T &value) {
+		memcpy(&value, in, sizeof(T));
+		in += sizeof(T);
+	}
+
+	template <typename T>
+	void operator()(std::vector<T> &values) {
+		memcpy(values.data(), in, values.size() * sizeof(T));
+		in += values.size() * sizeof(T);
+	}
+};
+
+// Data shared between processes lists the members the tile functions may
+// change as a tuple of references, returned by state().
+template <typename T>
+concept SharedState = requires (T &value) {
+	value.state();
+};
+
+// Calls f on every member of value's state, recursing into members which
+// have a state of their own.
+template <typename T, typename F>
+void visit_state(T &value, F &f) {
+	if constexpr (SharedState<T>) {
+		std::apply([&f] (auto &...members) {
+			(visit_state(members, f), ...);
+		}, value.state());
+	} else {
+		f(value);
+	}
+}
+
+#endif // SHARED_SEGMENT_HPP
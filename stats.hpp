@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <math.h>
+#include <array>
+#include <vector>
 
 struct Stats {
 	float total_crossbar_time = 0, total_crossbar_energy = 0, efficiency = 0,
@@ -22,6 +25,30 @@ struct Stats {
 		num_adc_acts += other.num_adc_acts;
 	}
 
+	void operator-= (const Stats &other) {
+		total_crossbar_time -= other.total_crossbar_time;
+		total_crossbar_energy -= other.total_crossbar_energy;
+		efficiency -= other.efficiency;
+		num_efficiencies -= other.num_efficiencies;
+		total_periphery_time -= other.total_periphery_time;
+		total_periphery_energy -= other.total_periphery_energy;
+		num_written_cells -= other.num_written_cells;
+		num_read_cells -= other.num_read_cells;
+		num_adc_acts -= other.num_adc_acts;
+	}
+
+	void operator*= (size_t factor) {
+		total_crossbar_time *= factor;
+		total_crossbar_energy *= factor;
+		efficiency *= factor;
+		num_efficiencies *= factor;
+		total_periphery_time *= factor;
+		total_periphery_energy *= factor;
+		num_written_cells *= factor;
+		num_read_cells *= factor;
+		num_adc_acts *= factor;
+	}
+
 	float get_average_efficiency() const {
 		return efficiency / num_efficiencies;
 	}
@@ -40,4 +67,90 @@ struct Stats {
 	Stats() = default;
 };
 
+// Estimate of the Stats of a run from a stratified sample of its tiles,
+// with the variance of every field.
+struct StatsEstimate {
+	static constexpr size_t NUM_FIELDS = 9;
+	using Fields = std::array<double, NUM_FIELDS>;
+
+	Fields total{}, variance{};
+
+	static Fields to_fields(const Stats &stats) {
+		return {stats.total_crossbar_time, stats.total_crossbar_energy,
+			stats.efficiency, stats.total_periphery_time,
+			stats.total_periphery_energy,
+			static_cast<double>(stats.num_efficiencies),
+			static_cast<double>(stats.num_written_cells),
+			static_cast<double>(stats.num_read_cells),
+			static_cast<double>(stats.num_adc_acts)};
+	}
+
+	static Stats from_fields(const Fields &fields) {
+		Stats stats;
+		stats.total_crossbar_time = fields[0];
+		stats.total_crossbar_energy = fields[1];
+		stats.efficiency = fields[2];
+		stats.total_periphery_time = fields[3];
+		stats.total_periphery_energy = fields[4];
+		stats.num_efficiencies = llround(fields[5]);
+		stats.num_written_cells = llround(fields[6]);
+		stats.num_read_cells = llround(fields[7]);
+		stats.num_adc_acts = llround(fields[8]);
+		return stats;
+	}
+
+	// Adds a stratum of population tiles, of which the given samples were
+	// drawn without replacement.
+	void add_stratum(size_t population, const std::vector<Stats> &samples) {
+		const auto n = static_cast<double>(samples.size());
+		const auto N = static_cast<double>(population);
+		if (!samples.size())
+			return;
+
+		Fields mean{}, sum_squares{};
+		for (auto &sample : samples) {
+			const auto fields = to_fields(sample);
+			for (size_t f = 0; f < NUM_FIELDS; f++)
+				mean[f] += fields[f] / n;
+		}
+		for (auto &sample : samples) {
+			const auto fields = to_fields(sample);
+			for (size_t f = 0; f < NUM_FIELDS; f++)
+				sum_squares[f] += (fields[f] - mean[f]) *
+					(fields[f] - mean[f]);
+		}
+
+		for (size_t f = 0; f < NUM_FIELDS; f++) {
+			total[f] += N * mean[f];
+			if (samples.size() > 1)
+				variance[f] += N * N * (1 - n / N) *
+					sum_squares[f] / (n - 1) / n;
+		}
+	}
+
+	void operator+= (const StatsEstimate &other) {
+		for (size_t f = 0; f < NUM_FIELDS; f++) {
+			total[f] += other.total[f];
+			variance[f] += other.variance[f];
+		}
+	}
+
+	Stats get_stats() const {
+		return from_fields(total);
+	}
+
+	// Prints every field with the half width of its 95% confidence
+	// interval.
+	void print() const {
+		const char *names[NUM_FIELDS] = {"total_crossbar_time",
+			"total_crossbar_energy", "efficiency_sum",
+			"total_periphery_time", "total_periphery_energy",
+			"num_efficiencies", "num_written_cells", "num_read_cells",
+			"num_adc_activations"};
+		for (size_t f = 0; f < NUM_FIELDS; f++)
+			printf("\t%s: %f +- %f\n", names[f], total[f],
+					1.96 * sqrt(variance[f]));
+	}
+};
+
 #endif // STATS_HPP
@@ -0,0 +1,16 @@
+# Runs delta-stepping SSSP on a graph whose heavy edge lands in a later
+# bucket than the light one, so the sweep after the first bucket settles
+# nothing. Vertices 5, 6, 8 and 300 must all be reached.
+import subprocess
+import sys
+
+main, graph = sys.argv[1:3]
+output = subprocess.run([main, '-S', '16', graph], check=True,
+                        capture_output=True, text=True).stdout
+
+lines = [line for line in output.splitlines()
+         if line.startswith('Delta-stepping')]
+expected = 'Delta-stepping settled 2 buckets in 4 sweeps, reaching 4 vertices'
+if not lines or any(line != expected for line in lines):
+    print('\n'.join(lines))
+    sys.exit(1)
@@ -0,0 +1,17 @@
+# Runs direction-optimizing BFS on a graph with fewer than BFS_BETA vertices,
+# where the bottom-up threshold rounds down to 0. The farthest vertices are
+# 5 steps from vertex 5, so every run has to end after one more step that
+# finds nothing.
+import re
+import subprocess
+import sys
+
+main, graph = sys.argv[1:3]
+output = subprocess.run([main, '-D', graph], check=True, capture_output=True,
+                        text=True, timeout=60).stdout
+
+steps = [int(n) for n in re.findall(r'stats \((\d+) steps\)', output)]
+if not steps or len(steps) % 2 or any(
+        top + bottom != 6 for top, bottom in zip(steps[::2], steps[1::2])):
+    print(steps)
+    sys.exit(1)
@@ -0,0 +1,25 @@
+# Runs delta PageRank on a graph with vertices past the last row block of the
+# tile grid, whose edges the compressed tiles drop. A tile file written from
+# it and read back must give the same out-degrees, so the same iterations, as
+# the edges in memory.
+import os
+import subprocess
+import sys
+import tempfile
+
+main, graph = sys.argv[1:3]
+
+def pagerank(*args):
+    output = subprocess.run([main, '-d', '1e-2', *args], check=True,
+                            capture_output=True, text=True).stdout
+    return [line for line in output.splitlines()
+            if line.startswith(('error:', 'active rows:'))]
+
+with tempfile.TemporaryDirectory() as tmp:
+    tiles = os.path.join(tmp, 'tiles')
+    in_memory = pagerank(graph)
+    streamed = pagerank('-T', tiles, graph)
+    reopened = pagerank(tiles)
+
+if not in_memory or streamed != in_memory or reopened != in_memory:
+    sys.exit(1)
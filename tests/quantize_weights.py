@@ -0,0 +1,14 @@
+# Runs quantized SSSP on a graph with a weight above 510, which a 16 bit
+# SparseMEM cell cannot store exactly next to its column. The graph has to
+# be rejected with a message instead of failing the comparison of results.
+import subprocess
+import sys
+
+main, graph = sys.argv[1:3]
+result = subprocess.run([main, '-q', graph], capture_output=True, text=True,
+                        timeout=60)
+
+if result.returncode != 1 or \
+        'Quantized SSSP needs integer weights' not in result.stdout:
+    print(result.returncode, result.stdout[-500:], result.stderr[-500:])
+    sys.exit(1)
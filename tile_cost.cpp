@@ -0,0 +1,141 @@
+#include "tile_cost.hpp"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <filesystem>
+#include <stdexcept>
+#include <type_traits>
+
+namespace {
+	constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+	constexpr uint64_t FNV_PRIME = 0x100000001b3;
+
+	uint64_t hash_bytes(const void *data, size_t size, uint64_t hash) {
+		const auto *bytes = static_cast<const uint8_t *>(data);
+		for (size_t k = 0; k < size; k++) {
+			hash ^= bytes[k];
+			hash *= FNV_PRIME;
+		}
+		return hash;
+	}
+
+	constexpr char COST_FILE_MAGIC[] = "GRCOSTS1";
+
+	// Followed by the tile ids and their counters.
+	struct CostFileHeader {
+		char magic[8];
+		uint64_t graph_hash, num_rows, num_cols;
+		char ordering[16];
+		char approach[32];
+		// Changes with the layout of the counters.
+		uint64_t counters_size;
+		uint64_t num_tiles;
+	};
+
+	static_assert(std::is_trivially_copyable_v<CrossbarCounters>);
+
+	CostFileHeader make_header(const TileCostKey &key) {
+		CostFileHeader header{};
+		memcpy(header.magic, COST_FILE_MAGIC, sizeof(header.magic));
+		header.graph_hash = key.graph_hash;
+		header.num_rows = key.num_rows;
+		header.num_cols = key.num_cols;
+		key.ordering.copy(header.ordering, sizeof(header.ordering) - 1);
+		key.approach.copy(header.approach, sizeof(header.approach) - 1);
+		header.counters_size = sizeof(CrossbarCounters);
+		return header;
+	}
+
+	template <typename T>
+	bool write_array(FILE *fp, const std::vector<T> &values) {
+		return fwrite(values.data(), sizeof(T), values.size(), fp) ==
+			values.size();
+	}
+
+	template <typename T>
+	bool read_array(FILE *fp, std::vector<T> &values, size_t size) {
+		values.resize(size);
+		return fread(values.data(), sizeof(T), size, fp) == size;
+	}
+}
+
+CrossbarCounters TileCosts::total() const {
+	CrossbarCounters total;
+	for (auto &tile : counters)
+		total += tile;
+	return total;
+}
+
+uint64_t hash_file(const std::string &path) {
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp)
+		throw std::runtime_error("cannot open " + path);
+
+	std::vector<uint8_t> block(size_t(1) << 20);
+	auto hash = FNV_OFFSET;
+	size_t n;
+	while ((n = fread(block.data(), 1, block.size(), fp)))
+		hash = hash_bytes(block.data(), n, hash);
+	const bool failed = ferror(fp);
+	fclose(fp);
+	if (failed)
+		throw std::runtime_error("cannot read " + path);
+	return hash;
+}
+
+uint64_t hash_string(const std::string &value) {
+	return hash_bytes(value.data(), value.size(), FNV_OFFSET);
+}
+
+TileCostCache::TileCostCache(std::string dir)
+	: _dir(std::move(dir))
+{}
+
+std::string TileCostCache::_path(const TileCostKey &key) const {
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016" PRIx64, key.graph_hash);
+	return _dir + "/" + hash + "-" + key.ordering + "-" +
+		std::to_string(key.num_rows) + "x" + std::to_string(key.num_cols) +
+		"-" + key.approach + ".costs";
+}
+
+std::optional<TileCosts> TileCostCache::load(const TileCostKey &key) const {
+	FILE *fp = fopen(_path(key).c_str(), "rb");
+	if (!fp)
+		return std::nullopt;
+
+	auto expected = make_header(key);
+	CostFileHeader header;
+	TileCosts costs;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1;
+	expected.num_tiles = header.num_tiles;
+	ok = ok && !memcmp(&header, &expected, sizeof(header)) &&
+		read_array(fp, costs.ids, header.num_tiles) &&
+		read_array(fp, costs.counters, header.num_tiles);
+	fclose(fp);
+	if (!ok)
+		return std::nullopt;
+	return costs;
+}
+
+void TileCostCache::store(const TileCostKey &key,
+		const TileCosts &costs) const {
+	std::filesystem::create_directories(_dir);
+
+	const auto path = _path(key);
+	const auto temporary = path + "." + std::to_string(getpid());
+	FILE *fp = fopen(temporary.c_str(), "wb");
+	if (!fp)
+		throw std::runtime_error("cannot create " + temporary);
+
+	auto header = make_header(key);
+	header.num_tiles = costs.ids.size();
+	const bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		write_array(fp, costs.ids) && write_array(fp, costs.counters);
+	if (fclose(fp) || !ok || rename(temporary.c_str(), path.c_str())) {
+		unlink(temporary.c_str());
+		throw std::runtime_error("cannot write " + path);
+	}
+}
@@ -0,0 +1,104 @@
+#ifndef TILE_COST_HPP
+#define TILE_COST_HPP
+
+#include "crossbar.hpp"
+#include "graph.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Crossbar operations of every non-empty tile of a graph under one approach:
+// the tile written once and every one of its rows read once. They only
+// depend on where the edges are, so Stats under other energy and latency
+// constants follow from them with counted_stats, without expanding a tile.
+struct TileCosts {
+	// Subgraph index of every tile, ascending, and its operations.
+	std::vector<size_t> ids;
+	std::vector<CrossbarCounters> counters;
+
+	CrossbarCounters total() const;
+};
+
+// Everything the tile costs depend on. The graph is identified by its
+// content, so an edited file gets new costs even under the same name.
+struct TileCostKey {
+	uint64_t graph_hash;
+	// Vertex ordering, which moves the edges between tiles.
+	std::string ordering;
+	size_t num_rows, num_cols;
+	// Approach and the way it reads rows, e.g. "graphr-pagerank".
+	std::string approach;
+};
+
+// 64-bit FNV-1a hash of a file's bytes, or of a string.
+uint64_t hash_file(const std::string &path);
+uint64_t hash_string(const std::string &value);
+
+// TileCosts kept in a directory across runs, one file per key. A file
+// records its key and the layout of the counters, so a lookup misses
+// instead of returning costs of other inputs or of an older build.
+class TileCostCache {
+public:
+	explicit TileCostCache(std::string dir);
+
+	std::optional<TileCosts> load(const TileCostKey &key) const;
+	// Writes a temporary file and renames it, so runs of a sweep that
+	// share the directory never see a partial entry.
+	void store(const TileCostKey &key, const TileCosts &costs) const;
+private:
+	std::string _path(const TileCostKey &key) const;
+
+	std::string _dir;
+};
+
+// Counts the operations of every non-empty tile on a fresh Approach per
+// thread. run_kernel is given row functions that make every row active, with
+// one input for the whole tile if MultiRow, as in PageRank, and elements are
+// dropped.
+template <typename Approach, bool MultiRow>
+TileCosts derive_tile_costs(const Graph &graph, const CrossbarOptions &options) {
+	struct NoData {};
+
+	TileCosts costs;
+	const auto sizes = graph.get_subgraph_sizes();
+	for (size_t id = 0; id < sizes.size(); id++) {
+		if (sizes[id])
+			costs.ids.push_back(id);
+	}
+	costs.counters.resize(costs.ids.size());
+
+	auto element_func = [] (auto &&...) {};
+
+	#pragma omp parallel
+	{
+		Approach approach(options);
+		NoData data;
+		SubGraph tile;
+
+		#pragma omp for schedule(dynamic, 16)
+		for (size_t t = 0; t < costs.ids.size(); t++) {
+			graph.get_subgraph_at(costs.ids[t], tile);
+
+			approach.clear();
+			const auto before = approach.get_counters();
+			approach.expand_to_crossbar(tile);
+			if constexpr (MultiRow) {
+				approach.run_kernel([] (NoData &) {
+					return std::optional<float>(0);
+				}, element_func, data);
+			} else {
+				approach.run_kernel([] (NoData &, size_t) {
+					return std::optional<int>(0);
+				}, element_func, data);
+			}
+			costs.counters[t] = approach.get_counters();
+			costs.counters[t] -= before;
+		}
+	}
+	return costs;
+}
+
+#endif // TILE_COST_HPP
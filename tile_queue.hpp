@@ -0,0 +1,61 @@
+#ifndef TILE_QUEUE_HPP
+#define TILE_QUEUE_HPP
+
+#include <stddef.h>
+#include <assert.h>
+#include <atomic>
+#include <vector>
+
+// Bounded lock-free single producer, single consumer ring of slots. Slots are
+// never destroyed while the queue lives, so whatever memory a slot owns is
+// reused by the next element the producer prepares in it.
+template <typename T>
+class TileQueue {
+public:
+	explicit TileQueue(size_t depth)
+	: _slots(depth)
+	{
+		assert(depth);
+	}
+
+	TileQueue(const TileQueue &) = delete;
+	TileQueue operator= (const TileQueue &) = delete;
+
+	// Producer side: returns the next free slot, or nullptr if full.
+	T *acquire() {
+		const auto tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) == _slots.size())
+			return nullptr;
+		return &_slots[tail % _slots.size()];
+	}
+
+	// Producer side: hands the slot returned by acquire to the consumer.
+	void publish() {
+		_tail.store(_tail.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+	// Consumer side: returns the oldest published slot, or nullptr if empty.
+	T *front() {
+		const auto head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return nullptr;
+		return &_slots[head % _slots.size()];
+	}
+
+	// Consumer side: gives the slot returned by front back to the producer.
+	void release() {
+		_head.store(_head.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+	size_t get_depth() const {
+		return _slots.size();
+	}
+private:
+	std::vector<T> _slots;
+	alignas(64) std::atomic<size_t> _head{0};
+	alignas(64) std::atomic<size_t> _tail{0};
+};
+
+#endif // TILE_QUEUE_HPP
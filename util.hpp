@@ -2,6 +2,7 @@
 #define UTIL_HPP
 
 #include <vector>
+#include <utility>
 #include <assert.h>
 
 inline constexpr auto round_up(const auto a, const auto b) {
@@ -15,4 +16,26 @@ inline void vector_binop(std::vector<T> &a, const std::vector<T> &b, BinOp op) {
 		a[i] = op(a[i], b[i]);
 }
 
+// Combines lambdas into one function object, e.g. to give an element
+// function both a per-cell and a per-row overload.
+template <typename... F>
+struct overloaded : F... {
+	using F::operator()...;
+};
+
+// Starts every element of a per-thread vector on its own cache line, so
+// threads updating neighbouring elements do not share lines.
+template <typename T>
+struct alignas(64) CacheAligned : T {
+	using T::T;
+
+	CacheAligned(const T &value)
+	: T(value)
+	{}
+
+	CacheAligned(T &&value)
+	: T(std::move(value))
+	{}
+};
+
 #endif // UTIL_HPP
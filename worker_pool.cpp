@@ -0,0 +1,100 @@
+#include "worker_pool.hpp"
+#include "util.hpp"
+
+#include <time.h>
+#include <sys/wait.h>
+
+namespace {
+	constexpr long WAIT_NS = 100'000'000;
+
+	void wait_for(pid_t pid) {
+		while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR)
+			;
+	}
+}
+
+WorkerPool::WorkerPool(WorkerPool &&other) = default;
+
+WorkerPool &WorkerPool::operator= (WorkerPool &&other) {
+	stop();
+	_segment = std::move(other._segment);
+	_shared_offset = other._shared_offset;
+	_slots_offset = other._slots_offset;
+	_slot_size = other._slot_size;
+	_pids = std::move(other._pids);
+	other._pids.clear();
+	return *this;
+}
+
+WorkerPool::~WorkerPool() {
+	stop();
+}
+
+void WorkerPool::_map(size_t num_workers, size_t shared_size,
+		size_t slot_size) {
+	// Keeps the shared area and the slots of different workers on
+	// separate cache lines.
+	_shared_offset = round_up(sizeof(Control) + num_workers * sizeof(sem_t),
+			size_t(64));
+	_slots_offset = _shared_offset + round_up(shared_size, size_t(64));
+	_slot_size = round_up(slot_size, size_t(64));
+	_segment = std::make_unique<SharedSegment>(
+			_slots_offset + num_workers * _slot_size);
+
+	sem_init(&_control().done, 1, 0);
+	_control().stop = false;
+	for (size_t p = 0; p < num_workers; p++)
+		sem_init(&_start(p), 1, 0);
+}
+
+void WorkerPool::run() {
+	assert(is_running());
+	for (size_t p = 0; p < _pids.size(); p++)
+		sem_post(&_start(p));
+
+	// Unlike a barrier, the semaphore lets the parent look after the
+	// workers while it waits, so one that died cannot hang it.
+	for (size_t done = 0; done < _pids.size();) {
+		timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += WAIT_NS;
+		if (deadline.tv_nsec >= 1'000'000'000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1'000'000'000;
+		}
+
+		if (!sem_timedwait(&_control().done, &deadline)) {
+			done++;
+			continue;
+		}
+		if (errno != ETIMEDOUT)
+			continue;
+
+		for (auto pid : _pids) {
+			if (waitpid(pid, nullptr, WNOHANG)) {
+				_kill();
+				throw std::runtime_error("a worker process failed");
+			}
+		}
+	}
+}
+
+void WorkerPool::stop() {
+	if (_pids.empty())
+		return;
+
+	_control().stop = true;
+	for (size_t p = 0; p < _pids.size(); p++)
+		sem_post(&_start(p));
+	for (auto pid : _pids)
+		wait_for(pid);
+	_pids.clear();
+}
+
+void WorkerPool::_kill() {
+	for (auto pid : _pids)
+		kill(pid, SIGKILL);
+	for (auto pid : _pids)
+		wait_for(pid);
+	_pids.clear();
+}
@@ -0,0 +1,129 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <stddef.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "numa.hpp"
+#include "shared_segment.hpp"
+
+// Worker processes that are forked once and then take one step whenever
+// the parent calls run, in lockstep with it. Parent and workers exchange
+// data through a shared segment: one area every worker reads, and a slot
+// per worker. A worker lives on the snapshot of the parent taken at start,
+// so everything it reads besides the segment has to stay as it was.
+class WorkerPool {
+public:
+	WorkerPool() = default;
+
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool(WorkerPool &&other);
+
+	WorkerPool operator= (const WorkerPool &) = delete;
+	WorkerPool &operator= (WorkerPool &&other);
+
+	~WorkerPool();
+
+	// Stops the running workers and forks num_workers new ones, pinned
+	// like the thread with their number. Worker p calls step(p) for every
+	// run and must not use OpenMP, whose threads are not forked along.
+	template <typename Step>
+	void start(size_t num_workers, size_t shared_size, size_t slot_size,
+			Step step);
+	// Lets every worker take one step and waits for all of them. Throws
+	// if one of them failed, which stops the others.
+	void run();
+	// Lets the workers exit and waits for them.
+	void stop();
+
+	bool is_running() const {
+		return !_pids.empty();
+	}
+
+	std::byte *get_shared() {
+		return _segment->data() + _shared_offset;
+	}
+
+	std::byte *get_slot(size_t p) {
+		return _segment->data() + _slots_offset + p * _slot_size;
+	}
+private:
+	struct Control {
+		// Posted by every worker once its step is done.
+		sem_t done;
+		bool stop;
+	};
+
+	Control &_control() {
+		return *reinterpret_cast<Control *>(_segment->data());
+	}
+
+	// Posted by the parent to start a step of worker p, one for each
+	// worker so a fast one cannot take the step of another.
+	sem_t &_start(size_t p) {
+		return *reinterpret_cast<sem_t *>(_segment->data() +
+				sizeof(Control) + p * sizeof(sem_t));
+	}
+
+	void _map(size_t num_workers, size_t shared_size, size_t slot_size);
+	template <typename Step>
+	[[noreturn]] void _work(size_t p, pid_t parent, Step &step);
+	// Kills and reaps every worker, after one of them failed.
+	void _kill();
+
+	std::unique_ptr<SharedSegment> _segment;
+	size_t _shared_offset = 0, _slots_offset = 0, _slot_size = 0;
+	std::vector<pid_t> _pids;
+};
+
+template <typename Step>
+void WorkerPool::start(size_t num_workers, size_t shared_size,
+		size_t slot_size, Step step) {
+	stop();
+	_map(num_workers, shared_size, slot_size);
+
+	const auto parent = getpid();
+	for (size_t p = 0; p < num_workers; p++) {
+		const auto pid = fork();
+		if (!pid)
+			_work(p, parent, step);
+		if (pid < 0) {
+			_kill();
+			throw std::runtime_error("cannot fork a worker process");
+		}
+		_pids.push_back(pid);
+	}
+}
+
+template <typename Step>
+void WorkerPool::_work(size_t p, pid_t parent, Step &step) {
+	// A worker must never return into the parent's code, nor outlive it.
+	try {
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		if (getppid() != parent)
+			_exit(1);
+		pin_current_thread(p);
+
+		while (true) {
+			while (sem_wait(&_start(p)) && errno == EINTR)
+				;
+			if (_control().stop)
+				break;
+			step(p);
+			sem_post(&_control().done);
+		}
+	} catch (...) {
+		_exit(1);
+	}
+	// Skips the exit handlers and stdio buffers of the parent.
+	_exit(0);
+}
+
+#endif // WORKER_POOL_HPP